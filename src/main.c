@@ -11,6 +11,7 @@
 
 #ifdef X11
 #include <X11/Xlib.h>
+#include <X11/extensions/shape.h>
 #include <gdk/gdkx.h>
 #include "x_interaction.h"
 #endif
@@ -22,6 +23,9 @@
 
 #include "mosaic_window_box.h"
 #include "mosaic_search_box.h"
+#include "mosaic_layout.h"
+#include "mosaic_search.h"
+#include "mosaic_frecency.h"
 
 static GtkWidget *window;
 static Window myown_window;
@@ -29,25 +33,138 @@ static Window *active_window; // For displaying it first in windows list.
 static Window *wins;
 static gchar **in_items; // If we read from stdin.
 static int wsize = 0;
-static GtkWidget **boxes;
+static GtkWidget **boxes; // One per window, if we don't read from stdin.
 static GtkWidget *layout;
 static GtkWidget *search;
-static GtkWidget **filtered_boxes;
+
+/* Items read from stdin are kept as plain records, a pool of boxes
+ * (no more than fit on the screen) is bound to the placed ones. */
+typedef struct {
+  gchar *name;
+  gchar *opt_name;
+  gint desktop;
+  gboolean show_desktop;
+  gchar *iconpath;
+  gchar *color;
+  MosaicSearchKey key;
+} Item;
+
+static Item *items;
+static GtkWidget **pool;
+static gint *pool_bound; // Item shown by each pool box, or -1.
+static gint pool_size;
+
+/* Indexes of all items and of the best matches of the search, ranked.
+ * Only as many matches are ranked as pages shown so far can hold. */
+static gint *all_items;
+static gint *filtered_items;
 static int filtered_size;
+static int filtered_total;
+static gint filtered_alloc;
+/* Items matching last_query in index order, with their scores. A query
+ * extending it can only match some of them, so only they are scanned. */
+static gchar *last_query;
+static gint *candidates;
+static gint *candidate_scores;
+static gint candidates_size;
+static gboolean candidates_valid;
+/* Goes up when items or their names change, cached results of older
+ * generations are not used. */
+static guint items_generation;
+/* Search in progress, scanned from the main loop in time slices so
+ * keys are handled in between. Scanned matches are candidates
+ * [0..candidates_size), items [search_pos..search_end) are left. */
+static MosaicSearchQuery search_query;
+static gboolean search_narrowing;
+static gint search_pos, search_end;
+static gboolean search_shown_partial;
+static guint search_source;
+#define SEARCH_SLICE_SIZE 65536
+#define SEARCH_SLICE_BUDGET 5000 // microseconds
+/* Search text edits are applied at once, but searching for the latest
+ * text is done once per frame, after all pending key events. */
+static guint refilter_source;
+
+/* In grouped mode windows of one WM_CLASS are shown as a single box,
+ * which expands into a mosaic of them. */
+typedef struct {
+  gchar *wm_class;
+  GtkWidget *box;
+  Window decorated_from; // Window the box took its icon and color from.
+  gint *members;
+  gint size;
+  gint alloc;
+} Group;
+
+static GHashTable *groups; // wm_class -> Group
+static GPtrArray *group_list; // Groups in order of their first window.
+/* Shown without search: lonely windows and groups (as wsize + index
+ * in group_list). */
+static gint *top_items;
+static gint top_size;
+static Group *expanded_group;
 static int width, height;
+#ifdef X11
+/* Window shape is a list of rectangles, changed between frames only by
+ * the ones of boxes which were placed, moved or dropped. */
+static XRectangle *shape_union;
+static XRectangle *shape_cut;
+static guint shape_union_size, shape_cut_size;
+static guint shape_union_alloc, shape_cut_alloc;
+#else
 static GdkDrawable *window_shape_bitmap;
+#endif
 
 /* for window mask */
 typedef struct {
   gint x, y, width, height;
 } rect;
 
-static rect *box_rects;
-static guint boxes_drawn;
+/* Boxes placed by the last draw_mosaic, in placement order. */
+static GtkWidget **placed_boxes;
+static rect *placed_rects;
+static guint placed_size;
+static guint placed_alloc;
+/* Placement being built, swapped with the one above. */
+static GtkWidget **next_boxes;
+static rect *next_rects;
+static guint next_alloc;
+/* Whether search entry is a part of the current window shape. */
+static gboolean shape_has_search;
+
+/* Items which don't fit on the screen are split into pages of
+ * page_capacity boxes, only boxes of current_page are placed. */
+static gint current_page;
+static gint page_count = 1;
+static gint page_capacity;
+/* Whether search entry was opened by user, it is also shown
+ * without that when there are several pages, for the indicator. */
+static gboolean search_shown;
+
+/* Spatial index of the placement: box -> placement index + 1, and the
+ * layout table which maps grid cells back to placement indexes. */
+static GHashTable *placed_index;
+static const MosaicLayout *placed_layout;
+
+/* Icons and colors are fetched after the first frame, only for placed boxes. */
+#define DECORATE_FRAME_BUDGET 8000 // microseconds
+
+typedef struct {
+  gint index;
+  gchar *iconpath;
+  gchar *color;
+} Decoration;
+
+static GHashTable *undecorated;
+static guint decorate_source;
 
 /* for screenshot mode */
 static gboolean key_pressed;
 
+/* Window has an alpha channel and is blended by a compositing manager,
+ * so it needs neither a shape nor a screenshot background. */
+static gboolean composited;
+
 static GKeyFile *color_config;
 static gchar **fallback_colors;
 static gsize fallback_size;
@@ -76,6 +193,10 @@ static struct {
   gchar *color_file;
   gint selected;
   gboolean only_current;
+  gboolean group;
+  gboolean thumbnails;
+  gchar *layout_name;
+  MosaicLayoutMode layout;
 } options;
 
 typedef struct {
@@ -126,14 +247,38 @@ static GOptionEntry entries [] =
     "Pick colors from file", "<file>" },
   { "only-current", 'c', 0, G_OPTION_ARG_NONE, &options.only_current,
     "Only show windows on the current workspace.", NULL},
+  { "group", 'g', 0, G_OPTION_ARG_NONE, &options.group,
+    "Group windows of the same class into one box.", NULL},
+  { "thumbnails", 'm', 0, G_OPTION_ARG_NONE, &options.thumbnails,
+    "Show live thumbnails of windows (needs Composite extension).", NULL},
+  { "layout", 'L', 0, G_OPTION_ARG_STRING, &options.layout_name,
+    "How to place boxes: spiral, rows or columns (default: spiral)", "<mode>" },
   { NULL }
 };
 
 static GdkRectangle current_monitor_size ();
 static void draw_mosaic (GtkLayout *where,
-		  GtkWidget **widgets, int rsize,
+		  gint *list, int rsize,
 		  int focus_on,
 		  int rwidth, int rheight);
+static GtkWidget *item_box (gint item, gint slot);
+static void bind_item (GtkWidget *box, gint item);
+static const gchar *item_opt_name (gint item);
+static const MosaicSearchKey *item_key (gint item);
+static void invalidate_candidates ();
+static void rank_filtered (gint count);
+static void search_cancel ();
+static gboolean search_step (gpointer data);
+static gint *current_items (gint *size);
+static const gchar *group_key (gint item);
+static void group_free (Group *group);
+static void update_groups ();
+static void on_group_click (GtkWidget *widget, gpointer data);
+static void collapse_group ();
+static void move_focus (GtkDirectionType dir);
+static void flip_page (gint delta);
+static gboolean on_scroll (GtkWidget *widget, GdkEventScroll *event, gpointer data);
+static void show_search (gboolean shown);
 static void on_rect_click (GtkWidget *widget, gpointer data);
 static void update_box_list ();
 static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer data);
@@ -141,14 +286,26 @@ static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer da
 static GdkFilterReturn event_filter (XEvent *xevent, GdkEvent *event, gpointer data);
 #endif
 static void refilter (MosaicSearchBox *search_box, gpointer data);
+static void on_search_changed (MosaicSearchBox *search_box, gpointer data);
+static void flush_refilter ();
+static void shape_queue (const rect *r, gboolean add);
+static void update_shape (gboolean changed);
+static gboolean on_layout_expose (GtkWidget *widget, GdkEventExpose *event, gpointer data);
+static void clear_layout_background (GtkWidget *widget, gpointer data);
+#ifndef X11
 static void draw_mask (GdkDrawable *bitmap, guint size);
+#endif
+static gboolean search_in_shape ();
 static void read_stdin ();
-static GdkPixbuf* get_screenshot ();
+static GdkPixmap* get_screenshot ();
 static void read_config ();
 static void write_default_config ();
 static void on_focus_change (GtkWidget *widget, GdkEventFocus *event, gpointer data);
 static void read_colors ();
 static gboolean parse_format (Entry *entry, gchar *data);
+static void decoration_free (Decoration *decoration);
+static void schedule_decorations ();
+static gboolean decorate_step (gpointer data);
 void tab_event (gboolean shift);
 
 int main (int argc, char **argv)
@@ -174,8 +331,27 @@ int main (int argc, char **argv)
     exit(1);
   }
 
+  if (options.layout_name &&
+      !mosaic_layout_mode_from_string (options.layout_name, &options.layout)) {
+    g_printerr ("Unknown layout: %s\n", options.layout_name);
+    exit (1);
+  }
+
 #ifdef X11
   atoms_init ();
+  if (options.thumbnails && !options.read_stdin && !mosaic_thumbnail_init ()) {
+    g_printerr ("Thumbnails need Composite, Damage and Render extensions.\n");
+    options.thumbnails = FALSE;
+  }
+
+  // Names can also be searched by keys of other keyboard layouts.
+  gunichar *layout_chars;
+  int n_keys;
+  int n_groups = get_layout_chars (&layout_chars, &n_keys);
+  for (int group = 1; group < n_groups; group++)
+    mosaic_search_add_layout (layout_chars, layout_chars + group * n_keys, n_keys);
+  if (n_groups)
+    g_free (layout_chars);
 #endif
 
   if (already_opened ()) {
@@ -183,6 +359,9 @@ int main (int argc, char **argv)
     exit (1);
   }
 
+  // Without the table nothing is boosted, that's not worth an error.
+  mosaic_frecency_open ();
+
   if (options.read_stdin) {
     if(!options.format) {
       options.show_icons = FALSE;
@@ -216,6 +395,8 @@ int main (int argc, char **argv)
   if (options.color_file)
     read_colors ();
 
+  mosaic_icon_atlas_set_cell_size (options.icon_size);
+
 #ifdef WIN32
   if (options.persistent) {
 #ifdef DEBUG
@@ -276,18 +457,36 @@ int main (int argc, char **argv)
   g_signal_connect (G_OBJECT (window), "focus-out-event",
         	    G_CALLBACK (on_focus_change), NULL);
 /**/
+#ifdef X11
+  GdkColormap *rgba = gdk_screen_get_rgba_colormap (gdk_screen_get_default ());
+  if (rgba && compositing_manager_running ()) {
+    composited = TRUE;
+    options.screenshot = FALSE;
+    gtk_widget_set_colormap (window, rgba);
+    gtk_widget_set_app_paintable (window, TRUE);
+  }
+#endif
+
   layout = gtk_layout_new (NULL, NULL);
   gtk_container_add (GTK_CONTAINER (window), layout);
+  if (composited) {
+    gtk_widget_set_app_paintable (layout, TRUE);
+    g_signal_connect (G_OBJECT (layout), "expose-event",
+		      G_CALLBACK (on_layout_expose), NULL);
+    // GtkLayout sets the style background on realize and on style changes.
+    g_signal_connect_after (G_OBJECT (layout), "realize",
+			    G_CALLBACK (clear_layout_background), NULL);
+    g_signal_connect_after (G_OBJECT (layout), "style-set",
+			    G_CALLBACK (clear_layout_background), NULL);
+  }
 
   if (options.screenshot) {
     gtk_window_fullscreen (GTK_WINDOW (window));
 
-    GdkPixbuf *screenshot;
     GdkPixmap *background = NULL;
     GtkStyle *style = NULL;
-    screenshot = get_screenshot ();
+    background = get_screenshot ();
 
-    gdk_pixbuf_render_pixmap_and_mask (screenshot, &background, NULL, 0);
     style = gtk_style_new ();
     style->bg_pixmap [0] = background;
 
@@ -303,21 +502,32 @@ int main (int argc, char **argv)
   gtk_layout_put (GTK_LAYOUT (layout), search,
 		  (width - s_req.width)/2, height - s_req.height - options.box_height);
   g_signal_connect (G_OBJECT (search), "changed",
-		    G_CALLBACK (refilter), NULL);
+		    G_CALLBACK (on_search_changed), NULL);
 
   g_signal_connect (G_OBJECT (window), "key-press-event",
 		    G_CALLBACK (on_key_press), NULL);
+  gtk_widget_add_events (GTK_WIDGET (window), GDK_SCROLL_MASK);
+  g_signal_connect (G_OBJECT (window), "scroll-event",
+		    G_CALLBACK (on_scroll), NULL);
   g_signal_connect_swapped(G_OBJECT (window), "destroy",
         		   G_CALLBACK(gtk_main_quit), NULL);
 
-  if (!options.screenshot) {
+  if (!options.screenshot && !composited) {
+#ifdef X11
+    // Window starts empty, boxes are added to its shape as they are placed.
+    gtk_widget_realize (window);
+    XShapeCombineRectangles (gdk_x11_get_default_xdisplay (),
+			     GDK_WINDOW_XID (gtk_widget_get_window (window)),
+			     ShapeBounding, 0, 0, NULL, 0, ShapeSet, Unsorted);
+#else
     window_shape_bitmap = (GdkDrawable *) gdk_pixmap_new (NULL, width, height, 1);
     draw_mask (window_shape_bitmap, 0);
     gtk_widget_shape_combine_mask (window, window_shape_bitmap, 0, 0);
+#endif
   }
 
   gtk_widget_show_all (window);
-  gtk_widget_hide (search);
+  show_search (FALSE);
   gtk_window_present (GTK_WINDOW (window));
   gtk_window_set_keep_above (GTK_WINDOW (window), TRUE);
   
@@ -341,8 +551,10 @@ int main (int argc, char **argv)
 #endif
   update_box_list ();
 
-  draw_mosaic (GTK_LAYOUT (layout), boxes, wsize,
-               options.selected >= wsize ? 0 : options.selected,
+  gint size;
+  gint *list = current_items (&size);
+  draw_mosaic (GTK_LAYOUT (layout), list, size,
+               options.selected >= size ? 0 : options.selected,
 	       options.box_width, options.box_height);
 
 #ifdef X11
@@ -375,74 +587,221 @@ static GdkRectangle current_monitor_size ()
 }
 
 static void draw_mosaic (GtkLayout *where,
-		  GtkWidget **widgets, int rsize,
+		  gint *list, int rsize,
 		  int focus_on,
 		  int rwidth, int rheight)
 {
-  boxes_drawn = 0;
-  int cur_x = options.center_x - rwidth/2;
-  int cur_y = options.center_y - rheight/2;
-  if (rsize) {
-    int i = 0;
-    int offset = 0;
-    int max_offset = (width*2) / rwidth + (height*2) / rheight;
-    int side = 0;
-
-    while (i < rsize) {
-      int j = 0;
-      do {
-	if (i == rsize)
-	  break;
-	if (cur_x >= 0 && cur_x+rwidth <= width && cur_y >= 0 && cur_y+rheight <= height) {
-	  offset = 0;
-	  if (gtk_widget_get_parent (widgets[i]))
-	    gtk_layout_move (GTK_LAYOUT (where), widgets[i], cur_x, cur_y);
-	  else
-	    gtk_layout_put (GTK_LAYOUT (where), widgets[i], cur_x, cur_y);
-	  gtk_widget_set_size_request (widgets[i], rwidth, rheight);
-	  gtk_widget_show (widgets[i]);
-	  if (!options.screenshot) {
-	    box_rects[i].x = cur_x;
-	    box_rects[i].y = cur_y;
-	    boxes_drawn++;
-	  }
-	  i++;
-	} else {
-	  offset++;
-	}
-	if (side) {
-	  if (j % (side * 4) < side || j % (side * 4) >= side * 3)
-	    cur_x += rwidth;
-	  else
-	    cur_x -= rwidth;
-	  if (j % (side * 4) < side * 2)
-	    cur_y += rheight;
-	  else
-	    cur_y -= rheight;
-	}
-	j++;
-      } while (j < side * 4);
-      if (offset >= max_offset)
-	break;
-      side++;
-      cur_x = options.center_x - rwidth/2;
-      cur_y -= rheight;
+  const MosaicLayout *table = mosaic_layout_get (options.layout, width, height,
+						 rwidth, rheight,
+						 options.center_x, options.center_y);
+  page_capacity = MAX (table->size, 1);
+  // Unranked matches still count for pages.
+  gint total = (list == filtered_items) ? filtered_total : rsize;
+  page_count = MAX ((total + page_capacity - 1) / page_capacity, 1);
+  if (focus_on >= rsize)
+    // If some window was killed and focus was on the last element
+    focus_on = MAX (rsize-1, 0);
+  // Page is the one holding the focused item.
+  current_page = focus_on / page_capacity;
+  gint first = current_page * page_capacity;
+
+  int i = MIN (rsize - first, table->size);
+  if (i > next_alloc) {
+    next_alloc = table->size;
+    next_boxes = g_renew (GtkWidget *, next_boxes, next_alloc);
+    next_rects = g_renew (rect, next_rects, next_alloc);
+  }
+  for (int k = 0; k < i; k++) {
+    next_boxes[k] = item_box (list[first + k], k);
+    next_rects[k].x = table->cells[k].x;
+    next_rects[k].y = table->cells[k].y;
+    next_rects[k].width = rwidth;
+    next_rects[k].height = rheight;
+  }
+
+  // Only touch boxes whose placement differs from the previous one.
+  gboolean changed = (i != placed_size);
+  gboolean mapped = FALSE;
+  GHashTable *next_index = g_hash_table_new (g_direct_hash, g_direct_equal);
+  if (!placed_index)
+    placed_index = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  for (int k = 0; k < i; k++) {
+    GtkWidget *box = next_boxes[k];
+    gint old_k = GPOINTER_TO_INT (g_hash_table_lookup (placed_index, box)) - 1;
+    rect *old = (old_k >= 0) ? &placed_rects[old_k] : NULL;
+    g_hash_table_insert (next_index, box, GINT_TO_POINTER (k+1));
+    if (!old) {
+      shape_queue (&next_rects[k], TRUE);
+      if (gtk_widget_get_parent (box))
+	gtk_layout_move (GTK_LAYOUT (where), box, next_rects[k].x, next_rects[k].y);
+      else
+	gtk_layout_put (GTK_LAYOUT (where), box, next_rects[k].x, next_rects[k].y);
+      gtk_widget_set_size_request (box, rwidth, rheight);
+      gtk_widget_show (box);
+      mapped = TRUE;
+      changed = TRUE;
+    } else {
+      if (old->x != next_rects[k].x || old->y != next_rects[k].y) {
+	shape_queue (old, FALSE);
+	shape_queue (&next_rects[k], TRUE);
+	gtk_layout_move (GTK_LAYOUT (where), box, next_rects[k].x, next_rects[k].y);
+	changed = TRUE;
+      }
     }
-    if (focus_on >= rsize)
-      // If some window was killed and focus was on the last element
-      focus_on = rsize-1;
-    gtk_widget_grab_focus (widgets[focus_on]);
   }
-  if (!options.screenshot) {
-    draw_mask (window_shape_bitmap, rsize);
-    gtk_widget_shape_combine_mask (window, window_shape_bitmap, 0, 0);
+
+  for (int k = 0; k < placed_size; k++)
+    if (!g_hash_table_lookup (next_index, placed_boxes[k])) {
+      shape_queue (&placed_rects[k], FALSE);
+      gtk_widget_hide (placed_boxes[k]);
+      changed = TRUE;
+    }
+  g_hash_table_destroy (placed_index);
+  placed_index = next_index;
+
+  // Swap placement buffers.
+  GtkWidget **tmp_boxes = placed_boxes;
+  rect *tmp_rects = placed_rects;
+  guint tmp_alloc = placed_alloc;
+  placed_boxes = next_boxes;
+  placed_rects = next_rects;
+  placed_alloc = next_alloc;
+  placed_size = i;
+  next_boxes = tmp_boxes;
+  next_rects = tmp_rects;
+  next_alloc = tmp_alloc;
+
+  // Box k sits in the k-th cell of the table.
+  placed_layout = table;
+
+  if (focus_on - first < placed_size &&
+      !gtk_widget_is_focus (placed_boxes[focus_on - first]))
+    gtk_widget_grab_focus (placed_boxes[focus_on - first]);
+  schedule_decorations ();
+
+  mosaic_search_box_set_page_info (MOSAIC_SEARCH_BOX (search), current_page, page_count);
+  show_search (search_shown);
+
+  if (!options.screenshot && !composited)
+    update_shape (changed);
+
+  // Newly mapped boxes are stacked above the search entry.
+  if (mapped && search && gtk_widget_get_realized (search))
+    gdk_window_raise (search->window);
+}
+
+// Shows the page delta pages away from the current one, focusing its first box.
+static void flip_page (gint delta)
+{
+  flush_refilter ();
+  gint page = CLAMP (current_page + delta, 0, page_count - 1);
+  if (page == current_page)
+    return;
+
+  gint size;
+  gint *list = current_items (&size);
+  if (list == filtered_items && size < (page + 1) * page_capacity) {
+    rank_filtered ((page + 1) * page_capacity);
+    list = current_items (&size);
+  }
+  draw_mosaic (GTK_LAYOUT (layout), list, size,
+	       page * page_capacity, options.box_width, options.box_height);
+}
+
+static gboolean on_scroll (GtkWidget *widget, GdkEventScroll *event, gpointer data)
+{
+  if (event->direction == GDK_SCROLL_UP || event->direction == GDK_SCROLL_LEFT)
+    flip_page (-1);
+  else
+    flip_page (1);
+
+  return TRUE;
+}
+
+static void show_search (gboolean shown)
+{
+  search_shown = shown;
+  if (shown || page_count > 1)
+    gtk_widget_show (search);
+  else
+    gtk_widget_hide (search);
+}
+
+// Moves focus to the nearest placed box in given direction.
+static void move_focus (GtkDirectionType dir)
+{
+  flush_refilter ();
+  if (!placed_size)
+    return;
+
+  GtkWidget *focus = gtk_window_get_focus (GTK_WINDOW (window));
+  gint k = focus ? GPOINTER_TO_INT (g_hash_table_lookup (placed_index, focus)) - 1 : -1;
+  if (k < 0) {
+    gtk_widget_grab_focus (placed_boxes[0]);
+    return;
+  }
+
+  gint dx = 0, dy = 0;
+  switch (dir) {
+  case GTK_DIR_LEFT:
+    dx = -1;
+    break;
+  case GTK_DIR_RIGHT:
+    dx = 1;
+    break;
+  case GTK_DIR_UP:
+    dy = -1;
+    break;
+  case GTK_DIR_DOWN:
+    dy = 1;
+    break;
+  default:
+    return;
+  }
+
+  gint col = placed_layout->cells[k].col;
+  gint row = placed_layout->cells[k].row;
+  // Skip holes: cells outside of the screen or not filled with boxes.
+  for (col += dx, row += dy;
+       col >= 0 && col < placed_layout->cols && row >= 0 && row < placed_layout->rows;
+       col += dx, row += dy) {
+    gint n = mosaic_layout_index_at (placed_layout, col, row);
+    if (n >= 0 && n < placed_size) {
+      gtk_widget_grab_focus (placed_boxes[n]);
+      return;
+    }
   }
+
+  // Nothing in line (ragged page edge or spiral hole): take the nearest
+  // box on that side, like default GTK focus did.
+  col = placed_layout->cells[k].col;
+  row = placed_layout->cells[k].row;
+  gint best = -1, best_distance = G_MAXINT;
+  for (int n = 0; n < placed_size; n++) {
+    gint along = (placed_layout->cells[n].col - col) * dx + (placed_layout->cells[n].row - row) * dy;
+    gint across = (placed_layout->cells[n].col - col) * dy + (placed_layout->cells[n].row - row) * dx;
+    gint distance = along * along + across * across;
+    if (along > 0 && distance < best_distance) {
+      best = n;
+      best_distance = distance;
+    }
+  }
+  if (best >= 0)
+    gtk_widget_grab_focus (placed_boxes[best]);
 }
 
 static void on_rect_click (GtkWidget *widget, gpointer data)
 {
   MosaicWindowBox *box = MOSAIC_WINDOW_BOX (widget);
 
+  // Same ids as search keys have: class of windows, label of items.
+  if (!options.read_stdin)
+    mosaic_frecency_add (mosaic_window_box_get_search_key (box)->id);
+  else
+    mosaic_frecency_add (mosaic_frecency_id (mosaic_window_box_get_name (box)));
+  invalidate_candidates ();
+
   if (!options.read_stdin) {
     gtk_widget_hide (window);
     switch_to_window (mosaic_window_box_get_xwindow (box));
@@ -452,7 +811,7 @@ static void on_rect_click (GtkWidget *widget, gpointer data)
 
   if (options.persistent) {
     if (strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search)))) {
-      gtk_widget_hide (search);
+      show_search (FALSE);
       mosaic_search_box_set_text (MOSAIC_SEARCH_BOX (search), "\0");
     }
   } else {
@@ -462,7 +821,31 @@ static void on_rect_click (GtkWidget *widget, gpointer data)
 
 static void update_box_list ()
 {
+  if (!undecorated)
+    undecorated = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					 NULL, (GDestroyNotify) decoration_free);
+
   if (!options.read_stdin) {
+    invalidate_candidates ();
+    for (int k = 0; k < placed_size; k++) {
+      shape_queue (&placed_rects[k], FALSE);
+      // Group boxes outlive the update, hide them until they are placed again.
+      if (options.group)
+	gtk_widget_hide (placed_boxes[k]);
+    }
+    placed_size = 0;
+    if (placed_index)
+      g_hash_table_remove_all (placed_index);
+    if (groups) {
+      // Group boxes still waiting for decoration are queued again by update_groups.
+      GHashTableIter iter;
+      Group *group;
+      g_hash_table_iter_init (&iter, groups);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &group))
+	if (group->box && g_hash_table_lookup (undecorated, group->box))
+	  group->decorated_from = 0;
+    }
+    g_hash_table_remove_all (undecorated);
     if (wsize) {
       for (int i = 0; i < wsize; i++) {
 	gtk_widget_destroy (boxes[i]);
@@ -475,104 +858,376 @@ static void update_box_list ()
     wins = sorted_windows_list (&myown_window, active_window, &wsize, options.only_current);
 #ifdef X11
     if (wins) {
-      // Get PropertyNotify events from each relevant window.
+      // Get PropertyNotify events from each relevant window, and
+      // (un)mapping, resizes and destruction for thumbnails.
+      long mask = PropertyChangeMask | (options.thumbnails ? StructureNotifyMask : 0);
       for (int i = 0; i < wsize; i++) {
 	XSelectInput (gdk_x11_get_default_xdisplay (),
 		      wins[i],
-		      PropertyChangeMask);
+		      mask);
       }
     }
 #endif
+  } else if (items) {
+    // Stdin is read only once.
+    return;
   }
 
-  if (!options.screenshot && box_rects) {
-    free (box_rects);
-    box_rects = NULL;
-  }
+  all_items = g_renew (gint, all_items, MAX (wsize, 1));
+  for (int i = 0; i < wsize; i++)
+    all_items[i] = i;
 
-  if (wsize) {
-    boxes = (GtkWidget **) malloc (wsize * sizeof (GtkWidget *));
+  if (wsize && options.read_stdin) {
+    items = g_new0 (Item, wsize);
 
-    if (!options.screenshot) {
-      box_rects = (rect *) calloc (wsize, sizeof (rect));
-      for (int i = 0; i < wsize; i++) {
-	box_rects[i].width = options.box_width;
-	box_rects[i].height = options.box_height;
+    Entry entry;
+    for (int i = 0; i < wsize; i++) {
+      items[i].desktop = -1;
+      if(!options.format)
+        items[i].name = in_items[i];
+      else {
+        if(parse_format(&entry, in_items[i])){
+          items[i].name = g_strdup (entry.label);
+          if((entry.desktop)>=0) {//g_printerr("Custom background digits not implemented yet\n");
+            items[i].desktop = entry.desktop-1;
+            items[i].show_desktop = TRUE;
+          }
+          items[i].iconpath = g_strdup (entry.iconpath);
+          items[i].color = g_strdup (entry.color);
+          if(strlen(entry.opt_name)){
+            g_printerr("%s\n", entry.opt_name);
+            items[i].opt_name = g_strdup (entry.opt_name);
+          }
+        } else {
+          items[i].name = g_strdup ("Parse error");
+        }
       }
+      // Search keys are computed once, stdin items never change.
+      mosaic_search_key_set (&items[i].key, items[i].name, items[i].opt_name, NULL);
     }
+  } else if (wsize) {
+    boxes = (GtkWidget **) malloc (wsize * sizeof (GtkWidget *));
 
-    GError *col_error;
-    Entry entry;
     for (int i = 0; i < wsize; i++) {
-      if (!options.read_stdin) {
-	boxes[i] = mosaic_window_box_new_with_xwindow (wins[i]);
+      Decoration *decoration = g_new0 (Decoration, 1);
+      decoration->index = i;
+      boxes[i] = mosaic_window_box_new_with_xwindow (wins[i]);
 #ifdef X11
-	mosaic_window_box_set_show_desktop (MOSAIC_WINDOW_BOX (boxes[i]), options.show_desktop);
+      mosaic_window_box_set_show_desktop (MOSAIC_WINDOW_BOX (boxes[i]), options.show_desktop);
+      mosaic_window_box_set_show_thumbnail (MOSAIC_WINDOW_BOX (boxes[i]), options.thumbnails);
 #endif
-	mosaic_window_box_set_show_titles (MOSAIC_WINDOW_BOX (boxes[i]), options.show_titles);
-	if (options.show_icons)
-	  mosaic_window_box_setup_icon_from_wm (MOSAIC_WINDOW_BOX(boxes[i]), options.icon_size, options.icon_size);
-      } else {
-        if(!options.format)
-          boxes[i] = mosaic_window_box_new_with_name (in_items[i]);
-        else {
-          if(parse_format(&entry, in_items[i])){
-            boxes[i] = mosaic_window_box_new_with_name(entry.label);
-            if((entry.desktop)>=0) {//g_printerr("Custom background digits not implemented yet\n");
-              mosaic_window_box_set_desktop(MOSAIC_WINDOW_BOX(boxes[i]), entry.desktop-1);
-              mosaic_window_box_set_show_desktop (MOSAIC_WINDOW_BOX(boxes[i]), TRUE);
-            }
-            if(options.show_icons && (entry.iconpath)[0]!='*') {
-              if(strchr(entry.iconpath, '.')) {
-                mosaic_window_box_setup_icon_from_file(MOSAIC_WINDOW_BOX(boxes[i]), entry.iconpath,
-                                                         options.icon_size, options.icon_size);
-              } else {
-                mosaic_window_box_setup_icon_from_theme(MOSAIC_WINDOW_BOX(boxes[i]), entry.iconpath,
-                                                        options.icon_size, options.icon_size);
-              }
-            }
-            if(strlen(entry.opt_name)){
-              g_printerr("%s\n", entry.opt_name);
-              mosaic_window_box_set_opt_name(MOSAIC_WINDOW_BOX(boxes[i]), entry.opt_name);
-            }
-          } else {
-            boxes[i] = mosaic_window_box_new_with_name("Parse error");
-          }
-        }
-      }
+      mosaic_window_box_set_show_titles (MOSAIC_WINDOW_BOX (boxes[i]), options.show_titles);
       mosaic_box_set_font (MOSAIC_BOX (boxes [i]), options.font);
       mosaic_window_box_set_colorize (MOSAIC_WINDOW_BOX (boxes[i]), options.colorize);
       mosaic_window_box_set_color_offset (MOSAIC_WINDOW_BOX (boxes[i]), options.color_offset);
-      if (options.colorize && options.color_file) {
-	gchar *color = NULL;
-	if (!options.read_stdin) {
-	  const gchar *wm_class = mosaic_window_box_get_opt_name (MOSAIC_WINDOW_BOX (boxes[i]));
-	  gchar *class1 = g_strdup (wm_class);
-	  gchar *class2 = g_strdup (wm_class+strlen (class1)+1);
-	  if (g_key_file_has_key (color_config, "colors", class1, &col_error))
-	    color = g_key_file_get_string (color_config, "colors", class1, &col_error);
-	  else if (g_key_file_has_key (color_config, "colors", class2, &col_error))
-	    color = g_key_file_get_string (color_config, "colors", class2, &col_error);
-	  g_free (class1);
-	  g_free (class2);
-	}
+      // Icons and picked colors come later, from decorate_step.
+      g_hash_table_insert (undecorated, boxes[i], decoration);
+      g_signal_connect (G_OBJECT (boxes[i]), "clicked",
+			G_CALLBACK (on_rect_click), NULL);
+    }
+  }
 
-	if (!color && fallback_size)
-	  color = g_strdup (fallback_colors [i % fallback_size]);
+  if (options.group && !options.read_stdin)
+    update_groups ();
+}
 
-	if (color)
-	  mosaic_window_box_set_color_from_string (MOSAIC_WINDOW_BOX (boxes[i]), color);
+// Box showing the item, for stdin items it is the pool box of given slot.
+static GtkWidget *item_box (gint item, gint slot)
+{
+  if (!options.read_stdin) {
+    if (item >= wsize)
+      return ((Group *) g_ptr_array_index (group_list, item - wsize))->box;
+    return boxes[item];
+  }
 
-	g_free (color);
-      }
-      if(options.format) {
-        if((entry.color)[0]=='#')
-          mosaic_window_box_set_color_from_string(MOSAIC_WINDOW_BOX(boxes[i]), entry.color);
-      }
-      g_signal_connect (G_OBJECT (boxes[i]), "clicked",
+  if (slot >= pool_size) {
+    pool = g_renew (GtkWidget *, pool, slot + 1);
+    pool_bound = g_renew (gint, pool_bound, slot + 1);
+    for (int k = pool_size; k <= slot; k++) {
+      pool[k] = mosaic_window_box_new_with_name ("");
+      mosaic_box_set_font (MOSAIC_BOX (pool[k]), options.font);
+      mosaic_window_box_set_colorize (MOSAIC_WINDOW_BOX (pool[k]), options.colorize);
+      mosaic_window_box_set_color_offset (MOSAIC_WINDOW_BOX (pool[k]), options.color_offset);
+      g_signal_connect (G_OBJECT (pool[k]), "clicked",
 			G_CALLBACK (on_rect_click), NULL);
+      pool_bound[k] = -1;
     }
+    pool_size = slot + 1;
   }
+
+  if (pool_bound[slot] != item) {
+    bind_item (pool[slot], item);
+    pool_bound[slot] = item;
+  }
+
+  return pool[slot];
+}
+
+static void bind_item (GtkWidget *widget, gint item)
+{
+  MosaicWindowBox *box = MOSAIC_WINDOW_BOX (widget);
+
+  mosaic_window_box_set_name (box, items[item].name);
+  // Also picks the hashed color, from opt_name or name.
+  mosaic_window_box_set_opt_name (box, items[item].opt_name);
+  mosaic_window_box_set_desktop (box, items[item].desktop);
+  mosaic_window_box_set_show_desktop (box, items[item].show_desktop);
+  mosaic_window_box_unset_icon (box);
+
+  // Icons and picked colors come later, from decorate_step.
+  Decoration *decoration = g_new0 (Decoration, 1);
+  decoration->index = item;
+  decoration->iconpath = g_strdup (items[item].iconpath);
+  decoration->color = g_strdup (items[item].color);
+  g_hash_table_insert (undecorated, widget, decoration);
+}
+
+static const gchar *item_opt_name (gint item)
+{
+  if (options.read_stdin)
+    return items[item].opt_name;
+
+  return mosaic_window_box_get_opt_name (MOSAIC_WINDOW_BOX (boxes[item]));
+}
+
+static const MosaicSearchKey *item_key (gint item)
+{
+  if (options.read_stdin)
+    return &items[item].key;
+
+  return mosaic_window_box_get_search_key (MOSAIC_WINDOW_BOX (boxes[item]));
+}
+
+// Items shown now: the ones matching the search, or all of them.
+static gint *current_items (gint *size)
+{
+  if (strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search)))) {
+    *size = filtered_size;
+    return filtered_items;
+  }
+
+  if (expanded_group) {
+    *size = expanded_group->size;
+    return expanded_group->members;
+  }
+
+  if (options.group && !options.read_stdin) {
+    *size = top_size;
+    return top_items;
+  }
+
+  *size = wsize;
+  return all_items;
+}
+
+// WM_CLASS holds instance and class names, windows are grouped by the latter.
+static const gchar *group_key (gint item)
+{
+  const gchar *opt_name = item_opt_name (item);
+  if (!opt_name)
+    return "";
+#ifdef X11
+  if (g_strcmp0 (opt_name, "<empty>"))
+    return opt_name + strlen (opt_name) + 1;
+#endif
+  return opt_name;
+}
+
+static void group_free (Group *group)
+{
+  if (group == expanded_group)
+    expanded_group = NULL;
+  if (group->box) {
+    g_hash_table_remove (undecorated, group->box);
+    gtk_widget_destroy (group->box);
+  }
+  g_free (group->wm_class);
+  g_free (group->members);
+  g_free (group);
+}
+
+/* Regroups windows after the list has changed. Groups (and their boxes)
+ * live as long as they have windows, only members are recounted. */
+static void update_groups ()
+{
+  if (!groups) {
+    groups = g_hash_table_new_full (g_str_hash, g_str_equal,
+				    NULL, (GDestroyNotify) group_free);
+    group_list = g_ptr_array_new ();
+  }
+
+  GHashTableIter iter;
+  Group *group;
+  g_hash_table_iter_init (&iter, groups);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &group))
+    group->size = 0;
+  g_ptr_array_set_size (group_list, 0);
+
+  for (int i = 0; i < wsize; i++) {
+    const gchar *key = group_key (i);
+    group = g_hash_table_lookup (groups, key);
+    if (!group) {
+      group = g_new0 (Group, 1);
+      group->wm_class = g_strdup (key);
+      g_hash_table_insert (groups, group->wm_class, group);
+    }
+    // Groups go in order of their first window.
+    if (!group->size)
+      g_ptr_array_add (group_list, group);
+    if (group->size == group->alloc) {
+      group->alloc = group->alloc ? group->alloc * 2 : 4;
+      group->members = g_renew (gint, group->members, group->alloc);
+    }
+    group->members[group->size++] = i;
+  }
+
+  g_hash_table_iter_init (&iter, groups);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &group))
+    if (!group->size)
+      g_hash_table_iter_remove (&iter);
+
+  top_items = g_renew (gint, top_items, MAX (group_list->len, 1));
+  top_size = 0;
+  for (guint g = 0; g < group_list->len; g++) {
+    group = g_ptr_array_index (group_list, g);
+    if (group->size == 1) {
+      // Lonely window is shown as is.
+      top_items[top_size++] = group->members[0];
+      continue;
+    }
+
+    gchar *name = g_strdup_printf ("%s (%d)", group->wm_class, group->size);
+    if (!group->box) {
+      group->box = mosaic_window_box_new_with_name (name);
+      mosaic_window_box_set_show_titles (MOSAIC_WINDOW_BOX (group->box), options.show_titles);
+      mosaic_box_set_font (MOSAIC_BOX (group->box), options.font);
+      mosaic_window_box_set_colorize (MOSAIC_WINDOW_BOX (group->box), options.colorize);
+      mosaic_window_box_set_color_offset (MOSAIC_WINDOW_BOX (group->box), options.color_offset);
+      g_signal_connect (G_OBJECT (group->box), "clicked",
+			G_CALLBACK (on_group_click), group);
+    }
+    // Icon and color of the group come from its current first window.
+    if (group->decorated_from != wins[group->members[0]]) {
+      group->decorated_from = wins[group->members[0]];
+      Decoration *decoration = g_new0 (Decoration, 1);
+      decoration->index = group->members[0];
+      g_hash_table_insert (undecorated, group->box, decoration);
+    }
+    if (g_strcmp0 (mosaic_window_box_get_name (MOSAIC_WINDOW_BOX (group->box)), name))
+      mosaic_window_box_set_name (MOSAIC_WINDOW_BOX (group->box), name);
+    g_free (name);
+
+    top_items[top_size++] = wsize + g;
+  }
+}
+
+// Expands group into a mosaic of its windows.
+static void on_group_click (GtkWidget *widget, gpointer data)
+{
+  expanded_group = (Group *) data;
+  draw_mosaic (GTK_LAYOUT (layout), expanded_group->members, expanded_group->size, 0,
+	       options.box_width, options.box_height);
+}
+
+static void collapse_group ()
+{
+  expanded_group = NULL;
+
+  gint size;
+  gint *list = current_items (&size);
+  draw_mosaic (GTK_LAYOUT (layout), list, size, 0,
+	       options.box_width, options.box_height);
+}
+
+static void decoration_free (Decoration *decoration)
+{
+  g_free (decoration->iconpath);
+  g_free (decoration->color);
+  g_free (decoration);
+}
+
+// Fetches icon and picks color for the box.
+static void decorate_box (GtkWidget *widget, Decoration *decoration)
+{
+  MosaicWindowBox *box = MOSAIC_WINDOW_BOX (widget);
+
+  if (!options.read_stdin && !mosaic_window_box_get_is_window (box)) {
+    // Group box looks like its first window, decorate that one first.
+    GtkWidget *first = boxes[decoration->index];
+    Decoration *pending = g_hash_table_lookup (undecorated, first);
+    if (pending) {
+      decorate_box (first, pending);
+      g_hash_table_remove (undecorated, first);
+    }
+    mosaic_window_box_copy_decoration (box, MOSAIC_WINDOW_BOX (first));
+    return;
+  }
+
+  if (options.show_icons) {
+    if (!options.read_stdin) {
+      mosaic_window_box_setup_icon_from_wm (box, options.icon_size, options.icon_size);
+    } else if (decoration->iconpath && decoration->iconpath[0] != '*') {
+      if (strchr (decoration->iconpath, '.'))
+	mosaic_window_box_setup_icon_from_file (box, decoration->iconpath,
+						options.icon_size, options.icon_size);
+      else
+	mosaic_window_box_setup_icon_from_theme (box, decoration->iconpath,
+						 options.icon_size, options.icon_size);
+    }
+  }
+
+  if (options.colorize && options.color_file) {
+    gchar *color = NULL;
+    if (!options.read_stdin) {
+      const gchar *wm_class = mosaic_window_box_get_opt_name (box);
+      gchar *class1 = g_strdup (wm_class);
+      gchar *class2 = g_strdup (wm_class+strlen (class1)+1);
+      if (g_key_file_has_key (color_config, "colors", class1, NULL))
+	color = g_key_file_get_string (color_config, "colors", class1, NULL);
+      else if (g_key_file_has_key (color_config, "colors", class2, NULL))
+	color = g_key_file_get_string (color_config, "colors", class2, NULL);
+      g_free (class1);
+      g_free (class2);
+    }
+
+    if (!color && fallback_size)
+      color = g_strdup (fallback_colors [decoration->index % fallback_size]);
+
+    if (color)
+      mosaic_window_box_set_color_from_string (box, color);
+
+    g_free (color);
+  }
+
+  if (decoration->color && decoration->color[0] == '#')
+    mosaic_window_box_set_color_from_string (box, decoration->color);
+}
+
+static void schedule_decorations ()
+{
+  if (!decorate_source && undecorated && g_hash_table_size (undecorated))
+    decorate_source = g_idle_add (decorate_step, NULL);
+}
+
+// Decorates placed boxes in placement order, at most for a frame budget per call.
+static gboolean decorate_step (gpointer data)
+{
+  gint64 deadline = g_get_monotonic_time () + DECORATE_FRAME_BUDGET;
+
+  for (int i = 0; i < placed_size; i++) {
+    Decoration *decoration = g_hash_table_lookup (undecorated, placed_boxes [i]);
+    if (!decoration)
+      continue;
+
+    decorate_box (placed_boxes [i], decoration);
+    g_hash_table_remove (undecorated, placed_boxes [i]);
+
+    if (g_get_monotonic_time () >= deadline)
+      return TRUE;
+  }
+
+  decorate_source = 0;
+  return FALSE;
 }
 
 static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer data)
@@ -581,9 +1236,11 @@ static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer da
   switch (event->keyval) {
   case GDK_Escape:
     if (strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search)))
-	|| gtk_widget_get_visible (search)) {
-      gtk_widget_hide (search);
+	|| search_shown) {
+      show_search (FALSE);
       mosaic_search_box_set_text (MOSAIC_SEARCH_BOX (search), "\0");
+    } else if (expanded_group) {
+      collapse_group ();
     } else {
       if (options.persistent)
         gtk_widget_hide (window);
@@ -592,6 +1249,7 @@ static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer da
     }
     break;
   case GDK_Return:
+    flush_refilter ();
     if(strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search))) && !filtered_size &&
        options.read_stdin && options.permissive) {
       puts (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search)));
@@ -599,10 +1257,23 @@ static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer da
     }
     break;
   case GDK_Left:
+    move_focus (GTK_DIR_LEFT);
+    return TRUE;
   case GDK_Up:
+    move_focus (GTK_DIR_UP);
+    return TRUE;
   case GDK_Right:
+    move_focus (GTK_DIR_RIGHT);
+    return TRUE;
   case GDK_Down:
-    break;
+    move_focus (GTK_DIR_DOWN);
+    return TRUE;
+  case GDK_Page_Up:
+    flip_page (-1);
+    return TRUE;
+  case GDK_Page_Down:
+    flip_page (1);
+    return TRUE;
   case GDK_Tab:
     tab_event(FALSE);
     return TRUE;
@@ -611,17 +1282,18 @@ static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer da
     return TRUE;
     break;
   case GDK_End:
+    flush_refilter ();
     if (options.permissive) {
       MosaicWindowBox* box = MOSAIC_WINDOW_BOX (gtk_window_get_focus (GTK_WINDOW (window)));
       mosaic_search_box_set_text (MOSAIC_SEARCH_BOX (search), mosaic_window_box_get_name (box));
-      gtk_widget_show (search);
+      show_search (TRUE);
     }
     break;
   case GDK_BackSpace:
     mosaic_search_box_remove_symbols (MOSAIC_SEARCH_BOX (search), 1);
     if (!strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search))))
       if (!options.vim_mode)
-	gtk_widget_hide (search);
+	show_search (FALSE);
     break;
   default:
   {
@@ -630,18 +1302,19 @@ static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer da
       if (!options.vim_mode) {
 	switch (event->keyval) {
 	case GDK_n:
-	  gtk_widget_child_focus (layout, GTK_DIR_DOWN);
+	  move_focus (GTK_DIR_DOWN);
 	  break;
 	case GDK_p:
-	  gtk_widget_child_focus (layout, GTK_DIR_UP);
+	  move_focus (GTK_DIR_UP);
 	  break;
 	case GDK_f:
-	  gtk_widget_child_focus (layout, GTK_DIR_RIGHT);
+	  move_focus (GTK_DIR_RIGHT);
 	  break;
 	case GDK_b:
-	  gtk_widget_child_focus (layout, GTK_DIR_LEFT);
+	  move_focus (GTK_DIR_LEFT);
 	  break;
 	case GDK_m:
+	  flush_refilter ();
 	  if(strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search))) && !filtered_size &&
 	     options.read_stdin && options.permissive) {
 	    puts (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search)));
@@ -653,18 +1326,20 @@ static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer da
 	case GDK_h:
 	  mosaic_search_box_remove_symbols (MOSAIC_SEARCH_BOX (search), 1);
 	  if (!strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search))))
-	    gtk_widget_hide (search);
+	    show_search (FALSE);
 	  break;
 	case GDK_w:
 	  mosaic_search_box_kill_word (MOSAIC_SEARCH_BOX (search));
 	  if (!strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search))))
-	    gtk_widget_hide (search);
+	    show_search (FALSE);
 	  break;
 	case GDK_g:
 	  if (strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search)))
-	      || gtk_widget_get_visible (search)) {
-	    gtk_widget_hide (search);
+	      || search_shown) {
+	    show_search (FALSE);
 	    mosaic_search_box_set_text (MOSAIC_SEARCH_BOX (search), "\0");
+	  } else if (expanded_group) {
+	    collapse_group ();
 	  } else {
 	    gtk_main_quit ();
 	  }
@@ -687,22 +1362,22 @@ static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer da
     /*   } */
     /* } */
     
-    if (options.vim_mode && !gtk_widget_get_visible (search)) {
+    if (options.vim_mode && !search_shown) {
       switch (event->keyval) {
       case GDK_h:
-	gtk_widget_child_focus (layout, GTK_DIR_LEFT);
+	move_focus (GTK_DIR_LEFT);
 	break;
       case GDK_j:
-	gtk_widget_child_focus (layout, GTK_DIR_DOWN);
+	move_focus (GTK_DIR_DOWN);
 	break;
       case GDK_k:
-	gtk_widget_child_focus (layout, GTK_DIR_UP);
+	move_focus (GTK_DIR_UP);
 	break;
       case GDK_l:
-	gtk_widget_child_focus (layout, GTK_DIR_RIGHT);
+	move_focus (GTK_DIR_RIGHT);
 	break;
       case GDK_slash:
-	gtk_widget_show (search);
+	show_search (TRUE);
 	g_signal_emit_by_name (G_OBJECT (search), "changed", NULL);
 	break;
       }
@@ -714,7 +1389,7 @@ static gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer da
       mosaic_search_box_append_text (MOSAIC_SEARCH_BOX (search), key);
       int text_length = strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search)));
       if (text_length)
-	gtk_widget_show (search);
+	show_search (TRUE);
       return TRUE;
     }
   }
@@ -731,28 +1406,19 @@ static GdkFilterReturn event_filter (XEvent *xevent, GdkEvent *event, gpointer d
     if (win == gdk_x11_get_default_root_xwindow ()) {
       if (atom == a_NET_CLIENT_LIST) {
 	int focus_on = 0;
-	if (filtered_size && filtered_boxes) {
-	  for (int i = 0; i < filtered_size; i++)
-	    if (gtk_widget_is_focus (filtered_boxes [i])) {
-	      focus_on = i;
-	      break;
-	    }
-	} else {
-	  for (int i = 0; i < wsize; i++)
-	    if (gtk_widget_is_focus (boxes [i])) {
-	      focus_on = i;
-	      break;
-	    }
-	}
+	gint size;
+	gint *list = current_items (&size);
+	for (int i = 0; i < size; i++)
+	  if (gtk_widget_is_focus (item_box (list [i], i))) {
+	    focus_on = i;
+	    break;
+	  }
 	update_box_list ();
-	if (strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search)))) {
+	if (strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search))))
 	  refilter (MOSAIC_SEARCH_BOX (search), NULL);
-	  draw_mosaic (GTK_LAYOUT (layout), filtered_boxes, filtered_size, focus_on,
-		       options.box_width, options.box_height);
-	} else {
-	  draw_mosaic (GTK_LAYOUT (layout), boxes, wsize, focus_on,
-		       options.box_width, options.box_height);
-	}
+	list = current_items (&size);
+	draw_mosaic (GTK_LAYOUT (layout), list, size, focus_on,
+		     options.box_width, options.box_height);
       }
     } else {
       if (atom == a_WM_NAME || atom == a_NET_WM_NAME || atom == a_NET_WM_VISIBLE_NAME) {
@@ -760,6 +1426,7 @@ static GdkFilterReturn event_filter (XEvent *xevent, GdkEvent *event, gpointer d
 	for (int i = 0; i < wsize; i++)
 	  if (wins [i] == win) {
 	    mosaic_window_box_update_xwindow_name (MOSAIC_WINDOW_BOX (boxes[i]));
+	    invalidate_candidates ();
 	    break;
 	  }
       }
@@ -778,123 +1445,265 @@ static GdkFilterReturn event_filter (XEvent *xevent, GdkEvent *event, gpointer d
 }
 #endif
 
-static gboolean search_by_letters (const gchar *source, gint s_len, const gchar *letters, gint l_len)
+// Items or their names changed, next search scans all of them.
+static void invalidate_candidates ()
 {
-  gboolean found = FALSE;
-  const gchar *p1 = letters;
-  const gchar *p2 = source;
-  while (p1 < letters + l_len) {
-    gunichar c1 = g_utf8_get_char (p1);
-    found = FALSE;
-    while (p2 < source + s_len) {
-      gunichar c2 = g_utf8_get_char (p2);
-      if (c1 == c2) {
-	found = TRUE;
-	p2 = g_utf8_find_next_char (p2, NULL);
-	break;
-      }
-      p2 = g_utf8_find_next_char (p2, NULL);
-    }
-    if (!found)
+  if (search_source)
+    g_source_remove (search_source);
+  search_source = 0;
+  candidates_valid = FALSE;
+  items_generation++;
+
+  // Search of the current text starts over with the new items.
+  if (search && strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search))))
+    on_search_changed (MOSAIC_SEARCH_BOX (search), NULL);
+}
+
+// Ranks best count matches of the last search.
+static void rank_filtered (gint count)
+{
+  filtered_size = mosaic_search_top (candidates, candidate_scores, candidates_size,
+				     count, filtered_items);
+}
+
+static void show_filtered ()
+{
+  filtered_total = candidates_size;
+  // Only the first page is ranked, others are when flipped to.
+  rank_filtered (page_capacity);
+  draw_mosaic (GTK_LAYOUT (layout), filtered_items, filtered_size, 0,
+	       options.box_width, options.box_height);
+}
+
+/* Stops the search in progress. Its matches and the items it didn't
+ * reach yet include all matches of last_query and of its extensions,
+ * so they are kept as candidates for narrowing. */
+static void search_cancel ()
+{
+  if (!search_source)
+    return;
+
+  g_source_remove (search_source);
+  search_source = 0;
+  for (int k = search_pos; k < search_end; k++)
+    candidates [candidates_size++] = search_narrowing ? candidates [k] : k;
+}
+
+// Scans slices of items until SEARCH_SLICE_BUDGET is spent.
+static gboolean search_step (gpointer data)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  while (search_pos < search_end) {
+    gint end = MIN (search_pos + SEARCH_SLICE_SIZE, search_end);
+    candidates_size += mosaic_search_filter (&search_query, item_key,
+					     search_narrowing ? candidates : NULL,
+					     search_pos, end,
+					     candidates + candidates_size,
+					     candidate_scores + candidates_size);
+    search_pos = end;
+    if (g_get_monotonic_time () - start > SEARCH_SLICE_BUDGET)
       break;
-    p1 = g_utf8_find_next_char (p1, NULL);
   }
 
-  return found;
+  if (search_pos < search_end) {
+    // First screenful of matches is shown without waiting for the rest.
+    if (!search_shown_partial && candidates_size >= page_capacity) {
+      search_shown_partial = TRUE;
+      show_filtered ();
+    }
+    return TRUE;
+  }
+
+  search_source = 0;
+  show_filtered ();
+  mosaic_search_cache_store (last_query, items_generation,
+			     candidates, candidate_scores, candidates_size,
+			     filtered_items, filtered_size);
+  return FALSE;
 }
 
-static void refilter (MosaicSearchBox *search_box, gpointer data)
+static gboolean refilter_idle (gpointer data)
 {
-  if (filtered_size) {
-    free (filtered_boxes);
-  }
-  filtered_size = 0;
+  refilter_source = 0;
+  refilter (MOSAIC_SEARCH_BOX (search), NULL);
+  return FALSE;
+}
 
-  for (int i = 0; i < wsize; i++)
-      gtk_widget_hide (boxes [i]);
+// Runs before redraw and after input, so a burst of keys makes one search.
+static void on_search_changed (MosaicSearchBox *search_box, gpointer data)
+{
+  if (!refilter_source)
+    refilter_source = g_idle_add_full (G_PRIORITY_HIGH_IDLE, refilter_idle, NULL, NULL);
+}
 
-  gchar *search_for = g_utf8_casefold (mosaic_search_box_get_text (search_box), -1);
-  int s_size = strlen (search_for);
-  if (s_size) {
-    filtered_boxes = (GtkWidget **) malloc (wsize * sizeof (GtkWidget *));
+// Keys acting on the placed boxes need them to show all matches of the latest text.
+static void flush_refilter ()
+{
+  if (refilter_source)
+    refilter (MOSAIC_SEARCH_BOX (search), NULL);
+
+  if (search_source) {
+    g_source_remove (search_source);
+    // No use in showing the first screenful now.
+    search_shown_partial = TRUE;
+    while (search_step (NULL));
+  }
+}
 
-    GtkWidget **priority1 = (GtkWidget **) malloc (wsize * sizeof (GtkWidget *));
-    GtkWidget **priority2 = (GtkWidget **) malloc (wsize * sizeof (GtkWidget *));
-    GtkWidget **priority3 = (GtkWidget **) malloc (wsize * sizeof (GtkWidget *));
-    gint p1size = 0;
-    gint p2size = 0;
-    gint p3size = 0;
+static void refilter (MosaicSearchBox *search_box, gpointer data)
+{
+  if (refilter_source)
+    g_source_remove (refilter_source);
+  refilter_source = 0;
+  // Typing goes on, results of the previous text are not needed anymore.
+  search_cancel ();
 
-    for (int i = 0; i < wsize; i++) {
-      gchar *wname_cmp = NULL;
-      gchar *opt_name1_cmp = NULL;
-      gchar *opt_name2_cmp = NULL;
-      int wn_size = 0;
-      int op1_size = 0;
-      int op2_size = 0;
-
-      wname_cmp = g_utf8_casefold (mosaic_window_box_get_name (MOSAIC_WINDOW_BOX (boxes[i])), -1);
-      wn_size = strlen (wname_cmp);
-      const gchar *opt_name = mosaic_window_box_get_opt_name (MOSAIC_WINDOW_BOX (boxes[i]));
-      if (opt_name) {
-	opt_name1_cmp = g_utf8_casefold (opt_name, -1);
-	op1_size = strlen (opt_name1_cmp);
-	if (!options.read_stdin) {
-	  opt_name2_cmp = g_utf8_casefold (opt_name+op1_size+1, -1);
-	  op2_size = strlen (opt_name2_cmp);
-	}
-      }
-      gboolean found = FALSE;
-      if (g_str_has_prefix (wname_cmp, search_for)) {
-	found = TRUE;
-	priority1 [p1size++] = boxes [i];
-      }
-      if (!found && ((g_strstr_len (wname_cmp, wn_size, search_for) != NULL) ||
-		     (op1_size && g_str_has_prefix (opt_name1_cmp, search_for)) ||
-		     (op2_size && g_str_has_prefix (opt_name2_cmp, search_for)))) {
-	found = TRUE;
-	priority2 [p2size++] = boxes [i];
-      }
-      if (!found && ((search_by_letters (wname_cmp, wn_size, search_for, s_size)) ||
-		     (op1_size && g_strstr_len (opt_name1_cmp, op1_size, search_for) != NULL) ||
-		     (op2_size && g_strstr_len (opt_name2_cmp, op2_size, search_for) != NULL))) {
-	found = TRUE;
-	priority3 [p3size++] = boxes [i];
-      }
-      g_free (wname_cmp);
-      g_free (opt_name1_cmp);
-      g_free (opt_name2_cmp);
-      if (found)
-	filtered_size++;
+  gchar *search_for = g_utf8_casefold (mosaic_search_box_get_text (search_box), -1);
+  if (strlen (search_for)) {
+    if (filtered_alloc < wsize) {
+      filtered_alloc = wsize;
+      filtered_items = g_renew (gint, filtered_items, filtered_alloc);
+      candidates = g_renew (gint, candidates, filtered_alloc);
+      candidate_scores = g_renew (gint, candidate_scores, filtered_alloc);
+      candidates_valid = FALSE;
     }
 
-    for (int i = 0; i < p1size; i++)
-      filtered_boxes [i] = priority1 [i];
-    for (int i = 0; i < p2size; i++)
-      filtered_boxes [p1size+i] = priority2 [i];
-    for (int i = 0; i < p3size; i++)
-      filtered_boxes [p1size+p2size+i] = priority3 [i];
-
-    free (priority1);
-    free (priority2);
-    free (priority3);
+    // Backspace and retyped text are usually served from the cache.
+    const MosaicSearchResult *cached = mosaic_search_cache_lookup (search_for, items_generation);
+    if (cached) {
+      memcpy (candidates, cached->matches, cached->size * sizeof (gint));
+      memcpy (candidate_scores, cached->scores, cached->size * sizeof (gint));
+      candidates_size = filtered_total = cached->size;
+      memcpy (filtered_items, cached->ranked, cached->ranked_size * sizeof (gint));
+      filtered_size = cached->ranked_size;
+      g_free (last_query);
+      last_query = search_for;
+      candidates_valid = TRUE;
+      draw_mosaic (GTK_LAYOUT (layout), filtered_items, filtered_size, 0,
+		   options.box_width, options.box_height);
+      return;
+    }
 
-    draw_mosaic (GTK_LAYOUT (layout), filtered_boxes, filtered_size, 0,
-		 options.box_width, options.box_height);
+    search_narrowing = candidates_valid && g_str_has_prefix (search_for, last_query);
+    search_pos = 0;
+    search_end = search_narrowing ? candidates_size : wsize;
+    candidates_size = 0;
+    g_free (last_query);
+    last_query = search_for;
+    mosaic_search_query_init (&search_query, last_query);
+    candidates_valid = TRUE;
+    search_shown_partial = FALSE;
+
+    // Short lists are done right away, long ones continue from the main loop.
+    if (search_step (NULL))
+      search_source = g_idle_add (search_step, NULL);
   } else {
-    draw_mosaic (GTK_LAYOUT (layout), boxes, wsize, 0,
+    g_free (search_for);
+    candidates_valid = FALSE;
+    filtered_size = filtered_total = 0;
+    gint size;
+    gint *list = current_items (&size);
+    draw_mosaic (GTK_LAYOUT (layout), list, size, 0,
 		 options.box_width, options.box_height);
   }
+}
 
-  if (gtk_widget_get_visible (search)) {
-    // Stupid thing to show search entry at top level..
-    gtk_widget_hide (search);
-    gtk_widget_show (search);
+// Space between boxes is left fully transparent.
+static gboolean on_layout_expose (GtkWidget *widget, GdkEventExpose *event, gpointer data)
+{
+  cairo_t *cr = gdk_cairo_create (event->window);
+  gdk_cairo_region (cr, event->region);
+  cairo_clip (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  return FALSE;
+}
+
+// No background, so exposes don't flash it before the clear paint.
+static void clear_layout_background (GtkWidget *widget, gpointer data)
+{
+  if (gtk_widget_get_realized (widget))
+    gdk_window_set_back_pixmap (GTK_LAYOUT (widget)->bin_window, NULL, FALSE);
+}
+
+// Remembers a box rectangle to be added to or cut from the window shape.
+static void shape_queue (const rect *r, gboolean add)
+{
+#ifdef X11
+  if (options.screenshot || composited)
+    return;
+
+  XRectangle **rects = add ? &shape_union : &shape_cut;
+  guint *size = add ? &shape_union_size : &shape_cut_size;
+  guint *alloc = add ? &shape_union_alloc : &shape_cut_alloc;
+
+  if (*size == *alloc) {
+    *alloc = *alloc ? *alloc * 2 : 64;
+    *rects = g_renew (XRectangle, *rects, *alloc);
   }
 
-  g_free (search_for);
+  XRectangle *xr = &(*rects)[(*size)++];
+  xr->x = r->x;
+  xr->y = r->y;
+  xr->width = r->width;
+  xr->height = r->height;
+#endif
 }
 
+static void update_shape (gboolean changed)
+{
+  gboolean with_search = search_in_shape ();
+
+#ifdef X11
+  Display *display = gdk_x11_get_default_xdisplay ();
+  Window xwindow = GDK_WINDOW_XID (gtk_widget_get_window (window));
+
+  rect search_rect = { 0, 0, 0, 0 };
+  if (with_search || shape_has_search) {
+    GtkAllocation alloc;
+    gtk_widget_get_allocation (search, &alloc);
+    search_rect.x = alloc.x;
+    search_rect.y = alloc.y;
+    search_rect.width = alloc.width;
+    search_rect.height = alloc.height;
+  }
+
+  if (with_search != shape_has_search) {
+    // Search entry may overlap boxes, so the shape is built anew.
+    shape_union_size = shape_cut_size = 0;
+    for (int i = 0; i < placed_size; i++)
+      shape_queue (&placed_rects[i], TRUE);
+    if (with_search)
+      shape_queue (&search_rect, TRUE);
+    XShapeCombineRectangles (display, xwindow, ShapeBounding, 0, 0,
+			     shape_union, shape_union_size, ShapeSet, Unsorted);
+    shape_has_search = with_search;
+  } else {
+    // Cut dropped boxes first, their cells may be taken by new ones.
+    if (shape_cut_size) {
+      if (shape_has_search)
+	shape_queue (&search_rect, TRUE);
+      XShapeCombineRectangles (display, xwindow, ShapeBounding, 0, 0,
+			       shape_cut, shape_cut_size, ShapeSubtract, Unsorted);
+    }
+    if (shape_union_size)
+      XShapeCombineRectangles (display, xwindow, ShapeBounding, 0, 0,
+			       shape_union, shape_union_size, ShapeUnion, Unsorted);
+  }
+
+  shape_union_size = shape_cut_size = 0;
+#else
+  if (changed || with_search != shape_has_search) {
+    draw_mask (window_shape_bitmap, placed_size);
+    gtk_widget_shape_combine_mask (window, window_shape_bitmap, 0, 0);
+  }
+#endif
+}
+
+#ifndef X11
 static void draw_mask (GdkDrawable *bitmap, guint size)
 {
   cairo_t *cr;
@@ -909,30 +1718,39 @@ static void draw_mask (GdkDrawable *bitmap, guint size)
 
   cairo_set_source_rgb (cr, 1, 1, 1);
   // Show each mosaic_window_box.
-  for (int i = 0; i < boxes_drawn; i++) {
+  for (int i = 0; i < size; i++) {
     cairo_rectangle (cr,
-		     box_rects[i].x, box_rects[i].y,
-		     box_rects[i].width, box_rects[i].height);
+		     placed_rects[i].x, placed_rects[i].y,
+		     placed_rects[i].width, placed_rects[i].height);
     cairo_fill (cr);
   }
 
   // show search entry if it is active.
-  if (search) {
-    if (strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search))) ||
-	(options.vim_mode && gtk_widget_get_visible (search))) {
-      GtkAllocation alloc;
-      gtk_widget_get_allocation (search, &alloc);
-      cairo_rectangle (cr,
-		       alloc.x,
-		       alloc.y,
-		       alloc.width,
-		       alloc.height);
-      cairo_fill (cr);
-    }
+  shape_has_search = search_in_shape ();
+  if (shape_has_search) {
+    GtkAllocation alloc;
+    gtk_widget_get_allocation (search, &alloc);
+    cairo_rectangle (cr,
+		     alloc.x,
+		     alloc.y,
+		     alloc.width,
+		     alloc.height);
+    cairo_fill (cr);
   }
 
   cairo_destroy (cr);
 }
+#endif
+
+// Search entry is shown when it has text or was activated in vim mode.
+static gboolean search_in_shape ()
+{
+  if (!search)
+    return FALSE;
+
+  return strlen (mosaic_search_box_get_text (MOSAIC_SEARCH_BOX (search))) ||
+    (options.vim_mode && search_shown) || page_count > 1;
+}
 
 static void read_stdin ()
 {
@@ -953,7 +1771,8 @@ static void read_stdin ()
   }
 }
 
-static GdkPixbuf* get_screenshot ()
+// Screen contents are copied into a pixmap on the server side.
+static GdkPixmap* get_screenshot ()
 {
   GdkWindow *root_window = gdk_get_default_root_window ();
   gint x, y;
@@ -981,12 +1800,20 @@ static GdkPixbuf* get_screenshot ()
   if (sheight <= m_offset_y)
     m_offset_y = 0;
 
-  return gdk_pixbuf_get_from_drawable (NULL, root_window, NULL,
-				       x + options.screenshot_offset_x + m_offset_x,
-				       y + options.screenshot_offset_y + m_offset_y,
-				       0, 0,
-				       swidth - options.screenshot_offset_x - m_offset_x,
-				       sheight - options.screenshot_offset_y - m_offset_y);
+  gint pwidth = swidth - options.screenshot_offset_x - m_offset_x;
+  gint pheight = sheight - options.screenshot_offset_y - m_offset_y;
+  GdkPixmap *pixmap = gdk_pixmap_new (root_window, pwidth, pheight, -1);
+
+  // Copy what other windows show, not just the root window itself.
+  GdkGC *gc = gdk_gc_new (pixmap);
+  gdk_gc_set_subwindow (gc, GDK_INCLUDE_INFERIORS);
+  gdk_draw_drawable (pixmap, gc, root_window,
+		     x + options.screenshot_offset_x + m_offset_x,
+		     y + options.screenshot_offset_y + m_offset_y,
+		     0, 0, pwidth, pheight);
+  g_object_unref (gc);
+
+  return pixmap;
 }
 
 static void read_config ()
@@ -1006,6 +1833,8 @@ static void read_config ()
   options.screenshot = FALSE;
   options.screenshot_offset_x = 0;
   options.screenshot_offset_y = 0;
+  options.layout_name = g_strdup ("spiral");
+  options.layout = MOSAIC_LAYOUT_SPIRAL;
 
   gchar *filename = g_strjoin ("/", g_get_user_config_dir (), "xwinmosaic/config", NULL);
 
@@ -1049,6 +1878,12 @@ static void read_config ()
       options.at_pointer = g_key_file_get_boolean (config, group, "at_pointer", &error);
     if (g_key_file_has_key (config, group, "color_file", &error))
       options.color_file = g_key_file_get_string (config, group, "color_file", &error);
+    if (g_key_file_has_key (config, group, "group", &error))
+      options.group = g_key_file_get_boolean (config, group, "group", &error);
+    if (g_key_file_has_key (config, group, "thumbnails", &error))
+      options.thumbnails = g_key_file_get_boolean (config, group, "thumbnails", &error);
+    if (g_key_file_has_key (config, group, "layout", &error))
+      options.layout_name = g_key_file_get_string (config, group, "layout", &error);
   }
 
   g_key_file_free (config);
@@ -1078,6 +1913,9 @@ static void write_default_config ()
       fprintf (config, "screenshot_offset_y = %d\n", options.screenshot_offset_y);
       fprintf (config, "at_pointer = %s\n", (options.at_pointer) ? "true" : "false");
       fprintf (config, "# color_file = /path/to/file\n");
+      fprintf (config, "group = %s\n", (options.group) ? "true" : "false");
+      fprintf (config, "thumbnails = %s\n", (options.thumbnails) ? "true" : "false");
+      fprintf (config, "layout = %s\n", options.layout_name);
       fclose (config);
       }
   }
@@ -1145,35 +1983,36 @@ void tab_event (gboolean shift) //FIXME: put prototype for this function
                                 //in some header file
 {
   gboolean is_visible = FALSE;
+  flush_refilter ();
   g_object_get (window, "visible", &is_visible, NULL);
   if(is_visible) {
-    GtkWidget **bs;
-    guint bsize = 0;
-    if(gtk_widget_get_visible (search)) {
-      bs = filtered_boxes;
-      bsize = filtered_size;
-    } else {
-      bs = boxes;
-      bsize = wsize;
-    }
+    gint bsize = 0;
+    gint *list = current_items (&bsize);
     if (bsize == 0) return; // nothing to switch between
-    // Calculate current box by straightforward pointer comparison
-    guint current_box = 0;
-    MosaicWindowBox* box = MOSAIC_WINDOW_BOX (gtk_window_get_focus (GTK_WINDOW (window)));
-    for (guint i = 0; i < bsize; i++)
-      if (MOSAIC_WINDOW_BOX(box) == MOSAIC_WINDOW_BOX(bs[i])) {
-	current_box = i;
-	break;
-      }
+    // Position of the focused box in the list.
+    GtkWidget *focus = gtk_window_get_focus (GTK_WINDOW (window));
+    gint k = focus ? GPOINTER_TO_INT (g_hash_table_lookup (placed_index, focus)) - 1 : -1;
+    gint current_box = (k >= 0) ? current_page * page_capacity + k : 0;
+    if (list == filtered_items && bsize < filtered_total &&
+	(shift ? current_box == 0 : current_box == bsize-1)) {
+      // Next (or, wrapping around, last) match is not ranked yet.
+      rank_filtered (shift ? filtered_total : bsize + page_capacity);
+      list = current_items (&bsize);
+    }
     if(!shift) {
 	current_box < bsize-1 ? current_box++ : (current_box = 0);
     } else {
 	current_box > 0 ? current_box-- : (current_box = bsize-1);
     }
-    gtk_widget_grab_focus (bs[current_box]);
+    // Flips the page if the box is on another one.
+    draw_mosaic (GTK_LAYOUT (layout), list, bsize, current_box,
+		 options.box_width, options.box_height);
   } else {
+    expanded_group = NULL;
     update_box_list();
-    draw_mosaic (GTK_LAYOUT (layout), boxes, wsize, 0,
+    gint size;
+    gint *list = current_items (&size);
+    draw_mosaic (GTK_LAYOUT (layout), list, size, 0,
                  options.box_width, options.box_height);
     gtk_window_present (GTK_WINDOW (window));
   }
@@ -291,13 +291,30 @@ mosaic_box_get_name (MosaicBox *box)
   return box->name;
 }
 
-void mosaic_box_paint (MosaicBox *box, cairo_t *cr, gint width, gint height)
+MosaicBoxState mosaic_box_get_state (MosaicBox *box)
 {
-  gboolean has_focus = gtk_widget_has_focus (GTK_WIDGET (box));
+  MosaicBoxState state = MOSAIC_BOX_STATE_NORMAL;
+  g_return_val_if_fail (MOSAIC_IS_BOX (box), state);
 
+  if (box->on_box)
+    state |= MOSAIC_BOX_STATE_HOVER;
+  if (gtk_widget_has_focus (GTK_WIDGET (box)))
+    state |= MOSAIC_BOX_STATE_FOCUSED;
+
+  return state;
+}
+
+void mosaic_box_paint (MosaicBox *box, cairo_t *cr, gint width, gint height, MosaicBoxState state)
+{
+  mosaic_box_paint_frame (cr, width, height, state);
+}
+
+// Touches no widget, so tile workers may call it.
+void mosaic_box_paint_frame (cairo_t *cr, gint width, gint height, MosaicBoxState state)
+{
   // Draw border
   cairo_rectangle (cr, 0, 0, width, height);
-  if (has_focus) {
+  if (state & MOSAIC_BOX_STATE_FOCUSED) {
     cairo_set_source_rgb (cr, 1.0, 1.0, 1.0);
     cairo_set_line_width (cr, 4);
     cairo_stroke_preserve (cr);
@@ -311,8 +328,15 @@ void mosaic_box_set_font (MosaicBox *box, const gchar *font)
 {
   g_return_if_fail (MOSAIC_IS_BOX (box));
 
+  if (!g_strcmp0 (box->font, font))
+    return;
+
   if (box->font)
     g_free (box->font);
 
   box->font = g_strdup (font);
+
+  MosaicBoxClass *klass = MOSAIC_BOX_GET_CLASS (box);
+  if (klass->font_changed)
+    klass->font_changed (box);
 }
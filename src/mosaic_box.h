@@ -19,6 +19,14 @@ G_BEGIN_DECLS
 #define MOSAIC_IS_BOX_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), MOSAIC_TYPE_BOX))
 #define MOSAIC_BOX_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), MOSAIC_TYPE_BOX, MosaicBoxClass))
 
+/* Visual state of a box, used to pick a pre-rendered tile. */
+typedef enum {
+  MOSAIC_BOX_STATE_NORMAL  = 0,
+  MOSAIC_BOX_STATE_HOVER   = 1 << 0,
+  MOSAIC_BOX_STATE_FOCUSED = 1 << 1,
+  MOSAIC_BOX_N_STATES      = 1 << 2
+} MosaicBoxState;
+
 typedef struct _MosaicBox      MosaicBox;
 typedef struct _MosaicBoxClass MosaicBoxClass;
 
@@ -40,6 +48,7 @@ struct _MosaicBoxClass
   GtkDrawingAreaClass parent_class;
 
   void (* clicked)  (MosaicBox *box);
+  void (* font_changed) (MosaicBox *box);
 };
 
 GType mosaic_box_get_type (void);
@@ -47,7 +56,10 @@ GtkWidget* mosaic_box_new (void);
 void mosaic_box_set_name (MosaicBox *box, const gchar *name);
 const gchar *mosaic_box_get_name (MosaicBox *box);
 
-void mosaic_box_paint (MosaicBox *box, cairo_t *cr, gint width, gint height);
+MosaicBoxState mosaic_box_get_state (MosaicBox *box);
+
+void mosaic_box_paint (MosaicBox *box, cairo_t *cr, gint width, gint height, MosaicBoxState state);
+void mosaic_box_paint_frame (cairo_t *cr, gint width, gint height, MosaicBoxState state);
 void mosaic_box_set_font (MosaicBox *box, const gchar *font);
 
 G_END_DECLS
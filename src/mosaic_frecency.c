@@ -0,0 +1,154 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_frecency.c - how often and how recently items were chosen.
+ *
+ * The table is a fixed open-addressed hash of 64-bit label hashes in
+ * $XDG_DATA_HOME/xwinmosaic/frecency, mapped into memory, so opening it
+ * reads nothing and a lookup is a few probes. Uses are counted with the
+ * time of the last one; the value is the count weighted by its age.
+ * When a probe run is full, its weakest slot is reused.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <glib.h> // For G_OS_UNIX.
+#ifdef G_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "mosaic_frecency.h"
+
+#define FRECENCY_MAGIC 0x31524658 // "XFR1"
+#define FRECENCY_SLOTS 4096
+#define MAX_PROBE 16
+
+#define DAY (24 * 60 * 60)
+
+typedef struct {
+  guint64 id;
+  guint32 count;
+  guint32 last_used; // Seconds since the epoch.
+} Slot;
+
+typedef struct {
+  guint32 magic;
+  guint32 n_slots;
+  Slot slots [FRECENCY_SLOTS];
+} Table;
+
+static Table *table = NULL;
+static gchar *filename = NULL;
+static gint64 now = 0; // Ages are measured from here, not per lookup.
+
+gboolean mosaic_frecency_open ()
+{
+  if (table)
+    return TRUE;
+
+  gchar *dir = g_strjoin ("/", g_get_user_data_dir (), "xwinmosaic", NULL);
+  g_mkdir_with_parents (dir, 0755);
+  filename = g_strjoin ("/", dir, "frecency", NULL);
+  g_free (dir);
+  now = time (NULL);
+
+#ifdef G_OS_UNIX
+  int fd = open (filename, O_RDWR | O_CREAT, 0644);
+  if (fd == -1)
+    return FALSE;
+  struct stat st;
+  if (fstat (fd, &st) == -1 ||
+      (st.st_size != sizeof (Table) && ftruncate (fd, sizeof (Table)) == -1)) {
+    close (fd);
+    return FALSE;
+  }
+  void *map = mmap (NULL, sizeof (Table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return FALSE;
+  table = map;
+#else
+  // No mmap, the table is read whole and written back on every change.
+  gchar *contents;
+  gsize length;
+  table = g_new0 (Table, 1);
+  if (g_file_get_contents (filename, &contents, &length, NULL)) {
+    if (length == sizeof (Table))
+      memcpy (table, contents, length);
+    g_free (contents);
+  }
+#endif
+
+  if (table->magic != FRECENCY_MAGIC || table->n_slots != FRECENCY_SLOTS) {
+    memset (table, 0, sizeof (Table));
+    table->magic = FRECENCY_MAGIC;
+    table->n_slots = FRECENCY_SLOTS;
+  }
+  return TRUE;
+}
+
+// FNV-1a, never 0 as it marks empty slots.
+guint64 mosaic_frecency_id (const gchar *label)
+{
+  guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  for (const guchar *p = (const guchar *) label; *p; p++) {
+    hash ^= *p;
+    hash *= G_GUINT64_CONSTANT (0x100000001b3);
+  }
+  return hash ? hash : 1;
+}
+
+static guint slot_value (const Slot *slot)
+{
+  gint64 age = now - slot->last_used;
+  guint weight = age < DAY ? 8 : age < 7 * DAY ? 4 : age < 30 * DAY ? 2 : 1;
+  return MIN (slot->count, G_MAXUINT / 8) * weight;
+}
+
+/* Slot of id, or NULL. With insert, an empty or the weakest slot of the
+ * probe run is cleared for it. */
+static Slot *find_slot (guint64 id, gboolean insert)
+{
+  Slot *weakest = NULL;
+
+  for (int i = 0; i < MAX_PROBE; i++) {
+    Slot *slot = &table->slots [(id + i) % FRECENCY_SLOTS];
+    if (slot->id == id)
+      return slot;
+    if (!slot->id)
+      return insert ? slot : NULL;
+    if (insert && (!weakest || slot_value (slot) < slot_value (weakest)))
+      weakest = slot;
+  }
+
+  if (weakest)
+    memset (weakest, 0, sizeof (Slot));
+  return weakest;
+}
+
+// Returns weighted use count of the item, 0 if it was never chosen.
+guint mosaic_frecency_get (guint64 id)
+{
+  if (!table)
+    return 0;
+
+  Slot *slot = find_slot (id, FALSE);
+  return slot ? slot_value (slot) : 0;
+}
+
+void mosaic_frecency_add (guint64 id)
+{
+  if (!table)
+    return;
+
+  now = time (NULL);
+  Slot *slot = find_slot (id, TRUE);
+  slot->id = id;
+  if (slot->count < G_MAXUINT32)
+    slot->count++;
+  slot->last_used = now;
+
+#ifndef G_OS_UNIX
+  g_file_set_contents (filename, (const gchar *) table, sizeof (Table), NULL);
+#endif
+}
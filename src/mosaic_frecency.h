@@ -0,0 +1,19 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_frecency.h - how often and how recently items were chosen.
+ */
+
+#ifndef MOSAIC_FRECENCY_H
+#define MOSAIC_FRECENCY_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean mosaic_frecency_open ();
+guint64 mosaic_frecency_id (const gchar *label);
+guint mosaic_frecency_get (guint64 id);
+void mosaic_frecency_add (guint64 id);
+
+G_END_DECLS
+
+#endif /* MOSAIC_FRECENCY_H */
@@ -0,0 +1,205 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_icon_atlas.c - shared storage for box icons.
+ *
+ * Every distinct icon is uploaded once into a single surface similar to
+ * the root window (a server-side pixmap on X11), boxes only keep
+ * references to its cells.
+ */
+
+#include "mosaic_icon_atlas.h"
+
+#define ATLAS_COLUMNS 16
+#define ATLAS_DEFAULT_CELL 16
+
+static GHashTable *icons = NULL;
+static cairo_surface_t *atlas = NULL;
+static guint cell_size = ATLAS_DEFAULT_CELL;
+static gint n_slots = 0;
+static gint used_slots = 0;
+
+static void icon_free (MosaicIcon *icon)
+{
+  g_free (icon->key);
+  g_free (icon);
+}
+
+void mosaic_icon_atlas_set_cell_size (guint size)
+{
+  // Cells can't be resized after icons were uploaded.
+  g_return_if_fail (atlas == NULL);
+
+  cell_size = size ? size : ATLAS_DEFAULT_CELL;
+}
+
+static cairo_surface_t *atlas_surface_new (gint rows)
+{
+  cairo_t *cr = gdk_cairo_create (gdk_get_default_root_window ());
+  cairo_surface_t *surface = cairo_surface_create_similar (cairo_get_target (cr),
+							  CAIRO_CONTENT_COLOR_ALPHA,
+							  ATLAS_COLUMNS * cell_size,
+							  rows * cell_size);
+  cairo_destroy (cr);
+
+  return surface;
+}
+
+static void slot_origin (gint slot, gint *x, gint *y)
+{
+  *x = (slot % ATLAS_COLUMNS) * cell_size;
+  *y = (slot / ATLAS_COLUMNS) * cell_size;
+}
+
+// Doubles atlas capacity, old cells are copied on the server side.
+static void atlas_grow ()
+{
+  gint rows = n_slots ? (n_slots / ATLAS_COLUMNS) * 2 : 1;
+  cairo_surface_t *surface = atlas_surface_new (rows);
+
+  if (atlas) {
+    cairo_t *cr = cairo_create (surface);
+    cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface (cr, atlas, 0, 0);
+    cairo_paint (cr);
+    cairo_destroy (cr);
+    cairo_surface_destroy (atlas);
+  }
+
+  atlas = surface;
+  n_slots = rows * ATLAS_COLUMNS;
+}
+
+static gboolean icon_is_unused (gpointer key, gpointer value, gpointer data)
+{
+  return ((MosaicIcon *) value)->ref_count == 0;
+}
+
+static gint atlas_take_slot ()
+{
+  if (used_slots < n_slots)
+    return used_slots++;
+
+  // Icons nobody refers to are kept until their cell is needed.
+  MosaicIcon *unused = g_hash_table_find (icons, icon_is_unused, NULL);
+  if (unused) {
+    gint slot = unused->slot;
+    g_hash_table_remove (icons, unused->key);
+    return slot;
+  }
+
+  atlas_grow ();
+  return used_slots++;
+}
+
+// Key identifying icon by its content.
+gchar *mosaic_icon_atlas_key_for_pixbuf (GdkPixbuf *pixbuf)
+{
+  g_return_val_if_fail (GDK_IS_PIXBUF (pixbuf), NULL);
+
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  gint row_size = width * gdk_pixbuf_get_n_channels (pixbuf);
+  const guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+
+  GChecksum *checksum = g_checksum_new (G_CHECKSUM_MD5);
+  for (int i = 0; i < height; i++)
+    g_checksum_update (checksum, pixels + i * rowstride, row_size);
+
+  gchar *key = g_strdup_printf ("pixbuf:%dx%d:%s", width, height,
+				g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return key;
+}
+
+MosaicIcon *mosaic_icon_atlas_lookup (const gchar *key)
+{
+  if (!icons || !key)
+    return NULL;
+
+  MosaicIcon *icon = g_hash_table_lookup (icons, key);
+  return icon ? mosaic_icon_ref (icon) : NULL;
+}
+
+// Interns pixbuf under the key, uploading it if it is not there yet.
+MosaicIcon *mosaic_icon_atlas_add (const gchar *key, GdkPixbuf *pixbuf)
+{
+  g_return_val_if_fail (key != NULL, NULL);
+  g_return_val_if_fail (GDK_IS_PIXBUF (pixbuf), NULL);
+
+  MosaicIcon *icon = mosaic_icon_atlas_lookup (key);
+  if (icon)
+    return icon;
+
+  if (!icons)
+    icons = g_hash_table_new_full (g_str_hash, g_str_equal,
+				   NULL, (GDestroyNotify) icon_free);
+
+  GdkPixbuf *scaled = NULL;
+  gint width = gdk_pixbuf_get_width (pixbuf);
+  gint height = gdk_pixbuf_get_height (pixbuf);
+  if (width > cell_size || height > cell_size) {
+    gdouble scale = MIN ((gdouble) cell_size / width, (gdouble) cell_size / height);
+    width = MAX (1, width * scale);
+    height = MAX (1, height * scale);
+    scaled = gdk_pixbuf_scale_simple (pixbuf, width, height, GDK_INTERP_BILINEAR);
+    pixbuf = scaled;
+  }
+
+  icon = g_new0 (MosaicIcon, 1);
+  icon->key = g_strdup (key);
+  icon->ref_count = 1;
+  icon->slot = atlas_take_slot ();
+  icon->width = width;
+  icon->height = height;
+
+  gint x, y;
+  slot_origin (icon->slot, &x, &y);
+
+  // Upload is done once per distinct icon.
+  cairo_t *cr = cairo_create (atlas);
+  cairo_rectangle (cr, x, y, cell_size, cell_size);
+  cairo_clip (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  gdk_cairo_set_source_pixbuf (cr, pixbuf, x, y);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  if (scaled)
+    g_object_unref (scaled);
+
+  g_hash_table_insert (icons, icon->key, icon);
+
+  return icon;
+}
+
+MosaicIcon *mosaic_icon_ref (MosaicIcon *icon)
+{
+  g_return_val_if_fail (icon != NULL, NULL);
+
+  icon->ref_count++;
+  return icon;
+}
+
+void mosaic_icon_unref (MosaicIcon *icon)
+{
+  g_return_if_fail (icon != NULL);
+  g_return_if_fail (icon->ref_count > 0);
+
+  icon->ref_count--;
+}
+
+void mosaic_icon_paint (MosaicIcon *icon, cairo_t *cr, gdouble x, gdouble y)
+{
+  g_return_if_fail (icon != NULL);
+
+  gint sx, sy;
+  slot_origin (icon->slot, &sx, &sy);
+
+  cairo_save (cr);
+  cairo_rectangle (cr, x, y, icon->width, icon->height);
+  cairo_clip (cr);
+  cairo_set_source_surface (cr, atlas, x - sx, y - sy);
+  cairo_paint (cr);
+  cairo_restore (cr);
+}
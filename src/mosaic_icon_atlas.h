@@ -0,0 +1,36 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_icon_atlas.h - shared storage for box icons.
+ */
+
+#ifndef MOSAIC_ICON_ATLAS_H
+#define MOSAIC_ICON_ATLAS_H
+
+#include <gtk/gtk.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MosaicIcon MosaicIcon;
+
+/* Reference to an icon interned in the atlas. */
+struct _MosaicIcon
+{
+  /*< private >*/
+  gchar *key;
+  guint ref_count;
+  gint slot;
+  gint width, height;
+};
+
+void mosaic_icon_atlas_set_cell_size (guint size);
+gchar *mosaic_icon_atlas_key_for_pixbuf (GdkPixbuf *pixbuf);
+MosaicIcon *mosaic_icon_atlas_lookup (const gchar *key);
+MosaicIcon *mosaic_icon_atlas_add (const gchar *key, GdkPixbuf *pixbuf);
+
+MosaicIcon *mosaic_icon_ref (MosaicIcon *icon);
+void mosaic_icon_unref (MosaicIcon *icon);
+void mosaic_icon_paint (MosaicIcon *icon, cairo_t *cr, gdouble x, gdouble y);
+
+G_END_DECLS
+
+#endif /* MOSAIC_ICON_ATLAS_H */
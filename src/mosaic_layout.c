@@ -0,0 +1,165 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_layout.c - positions of boxes on the screen.
+ *
+ * Positions depend only on the screen area, box size and center point,
+ * so the table is computed once and then looked up by index.
+ */
+
+#include "mosaic_layout.h"
+
+static MosaicLayout *cached = NULL;
+
+gboolean mosaic_layout_mode_from_string (const gchar *name, MosaicLayoutMode *mode)
+{
+  if (!g_strcmp0 (name, "spiral"))
+    *mode = MOSAIC_LAYOUT_SPIRAL;
+  else if (!g_strcmp0 (name, "rows"))
+    *mode = MOSAIC_LAYOUT_ROWS;
+  else if (!g_strcmp0 (name, "columns"))
+    *mode = MOSAIC_LAYOUT_COLUMNS;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+static void layout_free (MosaicLayout *layout)
+{
+  g_free (layout->cells);
+  g_free (layout->grid);
+  g_free (layout);
+}
+
+static void add_cell (MosaicLayout *layout, gint x, gint y)
+{
+  MosaicLayoutCell *cell = &layout->cells [layout->size];
+  cell->x = x;
+  cell->y = y;
+  cell->col = (x - layout->origin_x) / layout->box_width;
+  cell->row = (y - layout->origin_y) / layout->box_height;
+  layout->grid [cell->row * layout->cols + cell->col] = layout->size;
+  layout->size++;
+}
+
+// Goes around the center box, ring by ring, until rings leave the screen.
+static void layout_spiral (MosaicLayout *layout)
+{
+  gint rwidth = layout->box_width;
+  gint rheight = layout->box_height;
+  int cur_x = layout->center_x - rwidth/2;
+  int cur_y = layout->center_y - rheight/2;
+  int offset = 0;
+  int max_offset = (layout->width*2) / rwidth + (layout->height*2) / rheight;
+  int side = 0;
+
+  while (layout->size < layout->cols * layout->rows) {
+    int j = 0;
+    do {
+      if (cur_x >= 0 && cur_x+rwidth <= layout->width &&
+	  cur_y >= 0 && cur_y+rheight <= layout->height) {
+	offset = 0;
+	add_cell (layout, cur_x, cur_y);
+      } else {
+	offset++;
+      }
+      if (side) {
+	if (j % (side * 4) < side || j % (side * 4) >= side * 3)
+	  cur_x += rwidth;
+	else
+	  cur_x -= rwidth;
+	if (j % (side * 4) < side * 2)
+	  cur_y += rheight;
+	else
+	  cur_y -= rheight;
+      }
+      j++;
+    } while (j < side * 4);
+    if (offset >= max_offset)
+      break;
+    side++;
+    cur_x = layout->center_x - rwidth/2;
+    cur_y -= rheight;
+  }
+}
+
+static void layout_rows (MosaicLayout *layout)
+{
+  for (int row = 0; row < layout->rows; row++)
+    for (int col = 0; col < layout->cols; col++)
+      add_cell (layout,
+		layout->origin_x + col * layout->box_width,
+		layout->origin_y + row * layout->box_height);
+}
+
+static void layout_columns (MosaicLayout *layout)
+{
+  for (int col = 0; col < layout->cols; col++)
+    for (int row = 0; row < layout->rows; row++)
+      add_cell (layout,
+		layout->origin_x + col * layout->box_width,
+		layout->origin_y + row * layout->box_height);
+}
+
+// Returns table for given parameters, computing it only when they change.
+const MosaicLayout *mosaic_layout_get (MosaicLayoutMode mode,
+				       gint width, gint height,
+				       gint box_width, gint box_height,
+				       gint center_x, gint center_y)
+{
+  g_return_val_if_fail (box_width > 0 && box_height > 0, NULL);
+
+  if (cached &&
+      cached->mode == mode &&
+      cached->width == width && cached->height == height &&
+      cached->box_width == box_width && cached->box_height == box_height &&
+      cached->center_x == center_x && cached->center_y == center_y)
+    return cached;
+
+  if (cached)
+    layout_free (cached);
+
+  MosaicLayout *layout = g_new0 (MosaicLayout, 1);
+  layout->mode = mode;
+  layout->width = width;
+  layout->height = height;
+  layout->box_width = box_width;
+  layout->box_height = box_height;
+  layout->center_x = center_x;
+  layout->center_y = center_y;
+
+  layout->origin_x = ((center_x - box_width/2) % box_width + box_width) % box_width;
+  layout->origin_y = ((center_y - box_height/2) % box_height + box_height) % box_height;
+  layout->cols = MAX ((width - layout->origin_x) / box_width, 0);
+  layout->rows = MAX ((height - layout->origin_y) / box_height, 0);
+
+  gint n_cells = layout->cols * layout->rows;
+  layout->cells = g_new (MosaicLayoutCell, MAX (n_cells, 1));
+  layout->grid = g_new (gint, MAX (n_cells, 1));
+  for (int i = 0; i < n_cells; i++)
+    layout->grid [i] = -1;
+
+  switch (mode) {
+  case MOSAIC_LAYOUT_ROWS:
+    layout_rows (layout);
+    break;
+  case MOSAIC_LAYOUT_COLUMNS:
+    layout_columns (layout);
+    break;
+  case MOSAIC_LAYOUT_SPIRAL:
+  default:
+    layout_spiral (layout);
+    break;
+  }
+
+  cached = layout;
+  return layout;
+}
+
+// Placement index of the cell, or -1 if it is outside of the table.
+gint mosaic_layout_index_at (const MosaicLayout *layout, gint col, gint row)
+{
+  if (col < 0 || col >= layout->cols || row < 0 || row >= layout->rows)
+    return -1;
+
+  return layout->grid [row * layout->cols + col];
+}
@@ -0,0 +1,48 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_layout.h - positions of boxes on the screen.
+ */
+
+#ifndef MOSAIC_LAYOUT_H
+#define MOSAIC_LAYOUT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  MOSAIC_LAYOUT_SPIRAL,
+  MOSAIC_LAYOUT_ROWS,
+  MOSAIC_LAYOUT_COLUMNS
+} MosaicLayoutMode;
+
+typedef struct {
+  gint x, y;
+  gint col, row;
+} MosaicLayoutCell;
+
+/* Table of cells in placement order. All cells lie on the grid passing
+ * through the center box, grid maps (col, row) back to placement index. */
+typedef struct {
+  MosaicLayoutMode mode;
+  gint width, height;
+  gint box_width, box_height;
+  gint center_x, center_y;
+
+  gint origin_x, origin_y;
+  gint cols, rows;
+
+  MosaicLayoutCell *cells;
+  gint size;
+  gint *grid;
+} MosaicLayout;
+
+gboolean mosaic_layout_mode_from_string (const gchar *name, MosaicLayoutMode *mode);
+const MosaicLayout *mosaic_layout_get (MosaicLayoutMode mode,
+				       gint width, gint height,
+				       gint box_width, gint box_height,
+				       gint center_x, gint center_y);
+gint mosaic_layout_index_at (const MosaicLayout *layout, gint col, gint row);
+
+G_END_DECLS
+
+#endif /* MOSAIC_LAYOUT_H */
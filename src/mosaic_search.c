@@ -0,0 +1,651 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_search.c - matching items against the search text.
+ *
+ * Keys and queries are casefolded beforehand, so matching is plain byte
+ * comparison. Every key has a mask of characters it contains, most keys
+ * are rejected by it without looking at the strings. Substrings are
+ * searched with SSE2 (or AVX2) for all texts; subsequences are scanned
+ * bytewise when the query is ASCII, which is exact for UTF-8 sources
+ * too, and by characters otherwise.
+ *
+ * An item matches if letters of the query appear in order in its title
+ * or the query is a part of its class. Score of the match rewards
+ * contiguous runs, word starts and the title prefix; class matches
+ * weigh half as much as title ones. Items chosen often and lately get
+ * a bonus growing with the log of their frecency.
+ *
+ * Long lists are filtered by a pool of workers, each scanning its own
+ * contiguous chunk into its own buffers. Chunks are merged in order, so
+ * results are the same as of a single scan. Only the best K matches are
+ * ranked, with a min-heap.
+ *
+ * Titles are also stored transliterated into other keyboard layouts
+ * (by the keys typing each character), so text typed in a wrong layout
+ * still matches with no extra work per keystroke.
+ *
+ * Results of recent queries are cached, so deleting and retyping
+ * characters costs nothing. Callers pass a generation number which
+ * changes with the items, results of older generations are dropped.
+ */
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "mosaic_search.h"
+#include "mosaic_frecency.h"
+
+// Lists shorter than this are filtered on the calling thread.
+#define PARALLEL_THRESHOLD 16384
+#define MIN_CHUNK_SIZE 4096
+
+#define SCORE_MATCH 16       // Per matched character.
+#define BONUS_CONSECUTIVE 8  // Character right after the previous one.
+#define BONUS_BOUNDARY 12    // Character starting a word.
+#define BONUS_PREFIX 32      // Match starting the title.
+#define PENALTY_GAP_MAX 16   // One per skipped byte, up to this per gap.
+#define BONUS_FRECENCY 8     // Per doubling of the frecency.
+
+#define CACHE_ENTRIES 16
+#define CACHE_ITEMS (1 << 20) // Matches kept in all entries together.
+
+/* Bits 0-25 are letters, 26-35 digits, other ASCII bytes share 36-62
+ * and any byte of a multibyte character is 63. */
+static inline guint64 char_bit (guchar c)
+{
+  if (c >= 'a' && c <= 'z')
+    return G_GUINT64_CONSTANT (1) << (c - 'a');
+  if (c >= '0' && c <= '9')
+    return G_GUINT64_CONSTANT (1) << (26 + c - '0');
+  if (c < 0x80)
+    return G_GUINT64_CONSTANT (1) << (36 + c % 27);
+  return G_GUINT64_CONSTANT (1) << 63;
+}
+
+static guint64 text_mask (const gchar *text, gint len)
+{
+  guint64 mask = 0;
+  for (int i = 0; i < len; i++)
+    mask |= char_bit (text[i]);
+  return mask;
+}
+
+static GPtrArray *layouts = NULL; // Maps of characters between layouts.
+
+// Registers a layout typing alt_chars [i] by the key typing chars [i].
+void mosaic_search_add_layout (const gunichar *chars, const gunichar *alt_chars, gint size)
+{
+  GHashTable *map = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  for (int i = 0; i < size; i++) {
+    gunichar c = g_unichar_tolower (chars [i]);
+    gunichar alt = g_unichar_tolower (alt_chars [i]);
+    if (!c || !alt || c == alt)
+      continue;
+    // Mapped both ways, a title may be in either layout.
+    if (!g_hash_table_lookup (map, GUINT_TO_POINTER (c)))
+      g_hash_table_insert (map, GUINT_TO_POINTER (c), GUINT_TO_POINTER (alt));
+    if (!g_hash_table_lookup (map, GUINT_TO_POINTER (alt)))
+      g_hash_table_insert (map, GUINT_TO_POINTER (alt), GUINT_TO_POINTER (c));
+  }
+
+  if (!g_hash_table_size (map)) {
+    g_hash_table_destroy (map);
+    return;
+  }
+  if (!layouts)
+    layouts = g_ptr_array_new ();
+  g_ptr_array_add (layouts, map);
+}
+
+// Returns name typed by the same keys in other layout, or NULL if it is the same.
+static gchar *transliterate (const gchar *name, GHashTable *map)
+{
+  GString *result = g_string_sized_new (strlen (name) * 2);
+  gboolean changed = FALSE;
+
+  for (const gchar *p = name; *p; p = g_utf8_next_char (p)) {
+    gunichar c = g_utf8_get_char (p);
+    gunichar alt = GPOINTER_TO_UINT (g_hash_table_lookup (map, GUINT_TO_POINTER (c)));
+    if (alt)
+      changed = TRUE;
+    g_string_append_unichar (result, alt ? alt : c);
+  }
+
+  return g_string_free (result, !changed);
+}
+
+static void alts_free (MosaicSearchKey *key)
+{
+  for (int i = 0; i < key->n_alts; i++)
+    g_free (key->alts [i].name);
+  g_free (key->alts);
+  key->alts = NULL;
+  key->n_alts = 0;
+}
+
+static void fold (const gchar *source, gchar **folded, gint *len)
+{
+  g_free (*folded);
+  *folded = source ? g_utf8_casefold (source, -1) : NULL;
+  *len = *folded ? strlen (*folded) : 0;
+}
+
+void mosaic_search_key_set (MosaicSearchKey *key, const gchar *name,
+			    const gchar *instance, const gchar *class)
+{
+  g_return_if_fail (key != NULL);
+
+  fold (name ? name : "", &key->name, &key->name_len);
+  fold (instance, &key->instance, &key->instance_len);
+  fold (class, &key->class, &key->class_len);
+  key->mask = text_mask (key->name, key->name_len) |
+    text_mask (key->instance, key->instance_len) |
+    text_mask (key->class, key->class_len);
+  key->id = mosaic_frecency_id (class ? class : (name ? name : ""));
+
+  alts_free (key);
+  for (int i = 0; layouts && i < layouts->len; i++) {
+    gchar *alt = transliterate (key->name, g_ptr_array_index (layouts, i));
+    if (!alt)
+      continue;
+    key->alts = g_renew (MosaicSearchAlt, key->alts, key->n_alts + 1);
+    MosaicSearchAlt *entry = &key->alts [key->n_alts++];
+    entry->name = alt;
+    entry->name_len = strlen (alt);
+    entry->mask = text_mask (alt, entry->name_len);
+    key->mask |= entry->mask;
+  }
+}
+
+void mosaic_search_key_clear (MosaicSearchKey *key)
+{
+  g_return_if_fail (key != NULL);
+
+  g_free (key->name);
+  g_free (key->instance);
+  g_free (key->class);
+  alts_free (key);
+  memset (key, 0, sizeof (MosaicSearchKey));
+}
+
+// Query text must be casefolded and outlive the query.
+void mosaic_search_query_init (MosaicSearchQuery *query, const gchar *text)
+{
+  g_return_if_fail (query != NULL);
+
+  query->text = text;
+  query->len = strlen (text);
+  query->mask = text_mask (text, query->len);
+  query->ascii = !(query->mask & (G_GUINT64_CONSTANT (1) << 63));
+}
+
+// memchr of libc is vectorized already.
+static inline const gchar *find_byte (const gchar *s, gint s_len, gchar c)
+{
+  return s_len > 0 ? memchr (s, c, s_len) : NULL;
+}
+
+/* Blocks where both the first and the last byte of needle match are
+ * found with vector compares, only they are compared fully. */
+static const gchar *find_substring (const gchar *s, gint s_len, const gchar *needle, gint n_len)
+{
+  if (n_len > s_len)
+    return NULL;
+  if (n_len == 1)
+    return find_byte (s, s_len, needle[0]);
+
+  gint i = 0;
+#if defined (__AVX2__)
+  const __m256i first = _mm256_set1_epi8 (needle[0]);
+  const __m256i last = _mm256_set1_epi8 (needle[n_len-1]);
+  for (; i + 32 + n_len - 1 <= s_len; i += 32) {
+    __m256i block_first = _mm256_loadu_si256 ((const __m256i *) (s + i));
+    __m256i block_last = _mm256_loadu_si256 ((const __m256i *) (s + i + n_len - 1));
+    guint mask = _mm256_movemask_epi8 (_mm256_and_si256 (_mm256_cmpeq_epi8 (first, block_first),
+							 _mm256_cmpeq_epi8 (last, block_last)));
+    while (mask) {
+      gint bit = g_bit_nth_lsf (mask, -1);
+      if (!memcmp (s + i + bit + 1, needle + 1, n_len - 2))
+	return s + i + bit;
+      mask &= mask - 1;
+    }
+  }
+#elif defined (__SSE2__)
+  const __m128i first = _mm_set1_epi8 (needle[0]);
+  const __m128i last = _mm_set1_epi8 (needle[n_len-1]);
+  for (; i + 16 + n_len - 1 <= s_len; i += 16) {
+    __m128i block_first = _mm_loadu_si128 ((const __m128i *) (s + i));
+    __m128i block_last = _mm_loadu_si128 ((const __m128i *) (s + i + n_len - 1));
+    guint mask = _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (first, block_first),
+						   _mm_cmpeq_epi8 (last, block_last)));
+    while (mask) {
+      gint bit = g_bit_nth_lsf (mask, -1);
+      if (!memcmp (s + i + bit + 1, needle + 1, n_len - 2))
+	return s + i + bit;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i + n_len <= s_len; i++)
+    if (s[i] == needle[0] && !memcmp (s + i, needle, n_len))
+      return s + i;
+  return NULL;
+}
+
+static gboolean is_boundary (const gchar *s, const gchar *p)
+{
+  return p == s || !g_ascii_isalnum (p[-1]);
+}
+
+// Score of the query found at p, the best one among its occurrences.
+static gint substring_score (const gchar *s, gint s_len, const MosaicSearchQuery *query)
+{
+  gint best = 0;
+  const gchar *p = s;
+  const gchar *end = s + s_len;
+
+  while ((p = find_substring (p, end - p, query->text, query->len))) {
+    gint score = query->len * SCORE_MATCH + (query->len - 1) * BONUS_CONSECUTIVE;
+    if (is_boundary (s, p))
+      score += BONUS_BOUNDARY;
+    if (p == s)
+      score += BONUS_PREFIX;
+    best = MAX (best, score);
+    if (p == s)
+      break;
+    p++;
+  }
+
+  return best;
+}
+
+static gint gap_penalty (gint gap)
+{
+  return MIN (gap, PENALTY_GAP_MAX);
+}
+
+/* Letters of ASCII query in order, taking the leftmost occurrences. They
+ * can't match inside multibyte characters, so bytes are compared. */
+static gint subsequence_score_bytes (const gchar *s, gint s_len, const MosaicSearchQuery *query)
+{
+  const gchar *end = s + s_len;
+  const gchar *p = s;
+  const gchar *last = NULL;
+  gint score = 0;
+
+  for (int i = 0; i < query->len; i++) {
+    const gchar *found = find_byte (p, end - p, query->text[i]);
+    if (!found)
+      return 0;
+    score += SCORE_MATCH;
+    if (last && found == last + 1)
+      score += BONUS_CONSECUTIVE;
+    else if (last)
+      score -= gap_penalty (found - last - 1);
+    if (is_boundary (s, found))
+      score += BONUS_BOUNDARY;
+    if (!last && found == s)
+      score += BONUS_PREFIX;
+    last = found;
+    p = found + 1;
+  }
+
+  return MAX (score, 1);
+}
+
+// Same for any query, comparing characters.
+static gint subsequence_score_chars (const gchar *s, gint s_len, const MosaicSearchQuery *query)
+{
+  const gchar *end = s + s_len;
+  const gchar *p = s;
+  const gchar *prev = NULL; // Character before p.
+  const gchar *last_end = NULL; // End of the last matched character.
+  gint score = 0;
+  const gchar *q = query->text;
+
+  while (q < query->text + query->len) {
+    gunichar c = g_utf8_get_char (q);
+    gboolean found = FALSE;
+    while (p < end) {
+      const gchar *next = g_utf8_find_next_char (p, end);
+      if (!next)
+	next = end;
+      if (g_utf8_get_char (p) == c) {
+	score += SCORE_MATCH;
+	if (last_end && p == last_end)
+	  score += BONUS_CONSECUTIVE;
+	else if (last_end)
+	  score -= gap_penalty (p - last_end);
+	if (!prev || !g_unichar_isalnum (g_utf8_get_char (prev)))
+	  score += BONUS_BOUNDARY;
+	if (!last_end && p == s)
+	  score += BONUS_PREFIX;
+	last_end = next;
+	found = TRUE;
+      }
+      prev = p;
+      p = next;
+      if (found)
+	break;
+    }
+    if (!found)
+      return 0;
+    q = g_utf8_find_next_char (q, NULL);
+  }
+
+  return MAX (score, 1);
+}
+
+static gint title_score (const gchar *name, gint name_len, const MosaicSearchQuery *query)
+{
+  // A contiguous run is better than any scattered match.
+  gint score = substring_score (name, name_len, query);
+  if (score)
+    return score;
+
+  return query->ascii ?
+    subsequence_score_bytes (name, name_len, query) :
+    subsequence_score_chars (name, name_len, query);
+}
+
+/* Returns score of the match, higher is better, or 0 if key doesn't
+ * match. Allocates nothing. */
+gint mosaic_search_key_score (const MosaicSearchKey *key, const MosaicSearchQuery *query)
+{
+  // Any match needs all characters of the query in one of the strings.
+  if (query->mask & ~key->mask)
+    return 0;
+
+  gint score = title_score (key->name, key->name_len, query);
+  for (int i = 0; i < key->n_alts; i++)
+    if (!(query->mask & ~key->alts [i].mask))
+      score = MAX (score, title_score (key->alts [i].name, key->alts [i].name_len, query));
+  gint class_score = MAX (substring_score (key->instance, key->instance_len, query),
+			  substring_score (key->class, key->class_len, query));
+
+  score = MAX (score, class_score / 2);
+  if (!score)
+    return 0;
+
+  guint frecency = mosaic_frecency_get (key->id);
+  return frecency ? score + BONUS_FRECENCY * g_bit_storage (frecency) : score;
+}
+
+typedef struct {
+  const MosaicSearchQuery *query;
+  MosaicSearchKeyFunc key_func;
+  const gint *scan;
+  gint begin, end;
+
+  /* Results of the chunk, buffers are kept for the next search. */
+  gint *matches;
+  gint *scores;
+  gint n_matches;
+  gint alloc;
+} SearchChunk;
+
+static GThreadPool *search_pool = NULL;
+static SearchChunk *chunks = NULL;
+static gint n_chunks_alloc = 0;
+static GMutex chunks_lock;
+static GCond chunks_done;
+static gint chunks_pending;
+
+// Matches may be scan itself: they are compacted in place and never overtake it.
+static gint scan_range (const MosaicSearchQuery *query, MosaicSearchKeyFunc key_func,
+			const gint *scan, gint begin, gint end,
+			gint *matches, gint *scores)
+{
+  gint n_matches = 0;
+
+  for (int k = begin; k < end; k++) {
+    gint item = scan ? scan [k] : k;
+    gint score = mosaic_search_key_score (key_func (item), query);
+    if (score) {
+      matches [n_matches] = item;
+      scores [n_matches] = score;
+      n_matches++;
+    }
+  }
+
+  return n_matches;
+}
+
+static void scan_chunk (SearchChunk *chunk)
+{
+  chunk->n_matches = scan_range (chunk->query, chunk->key_func, chunk->scan,
+				 chunk->begin, chunk->end,
+				 chunk->matches, chunk->scores);
+}
+
+static void scan_chunk_job (gpointer data, gpointer user_data)
+{
+  scan_chunk ((SearchChunk *) data);
+
+  g_mutex_lock (&chunks_lock);
+  if (--chunks_pending == 0)
+    g_cond_signal (&chunks_done);
+  g_mutex_unlock (&chunks_lock);
+}
+
+/* Matches items scan[begin..end) (or begin..end-1 if scan is NULL)
+ * against the query. Matching items and their scores are stored in scan
+ * order, both arrays must hold end-begin items; matches may point into
+ * scan at or before begin. Returns the number of matches. */
+gint mosaic_search_filter (const MosaicSearchQuery *query, MosaicSearchKeyFunc key_func,
+			  const gint *scan, gint begin, gint end,
+			  gint *matches, gint *scores)
+{
+  gint scan_size = end - begin;
+  gint n_chunks = MIN ((gint) g_get_num_processors (), scan_size / MIN_CHUNK_SIZE);
+
+  if (scan_size < PARALLEL_THRESHOLD || n_chunks < 2)
+    return scan_range (query, key_func, scan, begin, end, matches, scores);
+
+  if (!search_pool)
+    search_pool = g_thread_pool_new (scan_chunk_job, NULL,
+				     g_get_num_processors () - 1, FALSE, NULL);
+  if (n_chunks_alloc < n_chunks) {
+    chunks = g_renew (SearchChunk, chunks, n_chunks);
+    memset (chunks + n_chunks_alloc, 0, (n_chunks - n_chunks_alloc) * sizeof (SearchChunk));
+    n_chunks_alloc = n_chunks;
+  }
+
+  gint chunk_size = (scan_size + n_chunks - 1) / n_chunks;
+  for (int c = 0; c < n_chunks; c++) {
+    SearchChunk *chunk = &chunks [c];
+    chunk->query = query;
+    chunk->key_func = key_func;
+    chunk->scan = scan;
+    chunk->begin = begin + c * chunk_size;
+    chunk->end = MIN (end, chunk->begin + chunk_size);
+    if (chunk->alloc < chunk_size) {
+      chunk->alloc = chunk_size;
+      chunk->matches = g_renew (gint, chunk->matches, chunk->alloc);
+      chunk->scores = g_renew (gint, chunk->scores, chunk->alloc);
+    }
+  }
+
+  // First chunk is scanned here while workers do the others.
+  chunks_pending = n_chunks - 1;
+  for (int c = 1; c < n_chunks; c++)
+    g_thread_pool_push (search_pool, &chunks [c], NULL);
+  scan_chunk (&chunks [0]);
+
+  g_mutex_lock (&chunks_lock);
+  while (chunks_pending)
+    g_cond_wait (&chunks_done, &chunks_lock);
+  g_mutex_unlock (&chunks_lock);
+
+  // Chunks follow scan order, so concatenating them keeps it.
+  gint n_matches = 0;
+  for (int c = 0; c < n_chunks; c++) {
+    memcpy (matches + n_matches, chunks [c].matches, chunks [c].n_matches * sizeof (gint));
+    memcpy (scores + n_matches, chunks [c].scores, chunks [c].n_matches * sizeof (gint));
+    n_matches += chunks [c].n_matches;
+  }
+
+  return n_matches;
+}
+
+/* Ranking. The heap holds the best items seen so far with the worst of
+ * them at the root; equal scores are ordered by position in matches, so
+ * ranking is stable. */
+
+typedef struct {
+  gint score;
+  gint order;
+} HeapEntry;
+
+static HeapEntry *heap = NULL;
+static gint heap_alloc = 0;
+
+static inline gboolean worse (const HeapEntry *a, const HeapEntry *b)
+{
+  return a->score < b->score || (a->score == b->score && a->order > b->order);
+}
+
+static void sift_down (HeapEntry *h, gint size, gint i)
+{
+  for (;;) {
+    gint child = 2*i + 1;
+    if (child >= size)
+      break;
+    if (child + 1 < size && worse (&h [child+1], &h [child]))
+      child++;
+    if (!worse (&h [child], &h [i]))
+      break;
+    HeapEntry tmp = h [i];
+    h [i] = h [child];
+    h [child] = tmp;
+    i = child;
+  }
+}
+
+static void sift_up (HeapEntry *h, gint i)
+{
+  while (i > 0) {
+    gint parent = (i - 1) / 2;
+    if (!worse (&h [i], &h [parent]))
+      break;
+    HeapEntry tmp = h [i];
+    h [i] = h [parent];
+    h [parent] = tmp;
+    i = parent;
+  }
+}
+
+/* Stores at most k best of n matches into ranked, best first. Returns
+ * their number. Takes O(n log k). */
+gint mosaic_search_top (const gint *matches, const gint *scores, gint n, gint k, gint *ranked)
+{
+  k = MIN (k, n);
+  if (k <= 0)
+    return 0;
+
+  if (heap_alloc < k) {
+    heap_alloc = k;
+    heap = g_renew (HeapEntry, heap, heap_alloc);
+  }
+
+  gint size = 0;
+  for (int i = 0; i < n; i++) {
+    HeapEntry entry = { scores [i], i };
+    if (size < k) {
+      heap [size] = entry;
+      sift_up (heap, size++);
+    } else if (worse (&heap [0], &entry)) {
+      heap [0] = entry;
+      sift_down (heap, size, 0);
+    }
+  }
+
+  // Popping the worst one to the end leaves the best one first.
+  for (int last = size - 1; last >= 0; last--) {
+    HeapEntry worst = heap [0];
+    heap [0] = heap [last];
+    sift_down (heap, last, 0);
+    ranked [last] = matches [worst.order];
+  }
+
+  return size;
+}
+
+/* Query cache, most recently used entries first. */
+
+static GHashTable *cache = NULL; // query -> GList link in cache_lru
+static GQueue cache_lru = G_QUEUE_INIT;
+static gsize cache_items = 0;
+
+static void cache_remove (GList *link)
+{
+  MosaicSearchResult *result = link->data;
+
+  g_hash_table_remove (cache, result->query);
+  g_queue_delete_link (&cache_lru, link);
+  cache_items -= result->size;
+  g_free (result->query);
+  g_free (result->matches);
+  g_free (result->scores);
+  g_free (result->ranked);
+  g_free (result);
+}
+
+void mosaic_search_cache_store (const gchar *query, guint generation,
+				const gint *matches, const gint *scores, gint size,
+				const gint *ranked, gint ranked_size)
+{
+  g_return_if_fail (query != NULL);
+
+  // Results of huge lists matching almost everything are cheaper to redo.
+  if (size > CACHE_ITEMS / 4)
+    return;
+
+  if (!cache)
+    cache = g_hash_table_new (g_str_hash, g_str_equal);
+
+  GList *link = g_hash_table_lookup (cache, query);
+  if (link)
+    cache_remove (link);
+
+  MosaicSearchResult *result = g_new (MosaicSearchResult, 1);
+  result->query = g_strdup (query);
+  result->generation = generation;
+  result->matches = g_memdup (matches, size * sizeof (gint));
+  result->scores = g_memdup (scores, size * sizeof (gint));
+  result->size = size;
+  result->ranked = g_memdup (ranked, ranked_size * sizeof (gint));
+  result->ranked_size = ranked_size;
+
+  g_queue_push_head (&cache_lru, result);
+  g_hash_table_insert (cache, result->query, cache_lru.head);
+  cache_items += size;
+
+  while (cache_lru.length > CACHE_ENTRIES || cache_items > CACHE_ITEMS)
+    cache_remove (cache_lru.tail);
+}
+
+// Returns cached result of the query, or NULL if there is none for this generation.
+const MosaicSearchResult *mosaic_search_cache_lookup (const gchar *query, guint generation)
+{
+  if (!cache)
+    return NULL;
+
+  GList *link = g_hash_table_lookup (cache, query);
+  if (!link)
+    return NULL;
+
+  MosaicSearchResult *result = link->data;
+  if (result->generation != generation) {
+    cache_remove (link);
+    return NULL;
+  }
+
+  g_queue_unlink (&cache_lru, link);
+  g_queue_push_head_link (&cache_lru, link);
+  return result;
+}
@@ -0,0 +1,74 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_search.h - matching items against the search text.
+ */
+
+#ifndef MOSAIC_SEARCH_H
+#define MOSAIC_SEARCH_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Title as if it was typed in another keyboard layout. */
+typedef struct {
+  gchar *name;
+  gint name_len;
+  guint64 mask;
+} MosaicSearchAlt;
+
+/* Casefolded strings an item is searched by, computed once when the
+ * item or its names change. */
+typedef struct {
+  gchar *name;
+  gint name_len;
+  gchar *instance; // First part of WM_CLASS, or opt_name of stdin items.
+  gint instance_len;
+  gchar *class;    // Second part of WM_CLASS.
+  gint class_len;
+  guint64 mask;    // Characters present in any of the strings.
+  guint64 id;      // Frecency table id, of the class or else the title.
+  MosaicSearchAlt *alts;
+  gint n_alts;
+} MosaicSearchKey;
+
+/* Casefolded search text. */
+typedef struct {
+  const gchar *text;
+  gint len;
+  guint64 mask;
+  gboolean ascii;
+} MosaicSearchQuery;
+
+/* Complete result of a search: all matches in item order with their
+ * scores, and the ones ranked so far. */
+typedef struct {
+  gchar *query;
+  guint generation;
+  gint *matches;
+  gint *scores;
+  gint size;
+  gint *ranked;
+  gint ranked_size;
+} MosaicSearchResult;
+
+/* Returns key of the item, may be called from worker threads. */
+typedef const MosaicSearchKey *(* MosaicSearchKeyFunc) (gint item);
+
+void mosaic_search_add_layout (const gunichar *chars, const gunichar *alt_chars, gint size);
+void mosaic_search_key_set (MosaicSearchKey *key, const gchar *name,
+			    const gchar *instance, const gchar *class);
+void mosaic_search_key_clear (MosaicSearchKey *key);
+void mosaic_search_query_init (MosaicSearchQuery *query, const gchar *text);
+gint mosaic_search_key_score (const MosaicSearchKey *key, const MosaicSearchQuery *query);
+gint mosaic_search_filter (const MosaicSearchQuery *query, MosaicSearchKeyFunc key_func,
+			  const gint *scan, gint begin, gint end,
+			  gint *matches, gint *scores);
+void mosaic_search_cache_store (const gchar *query, guint generation,
+				const gint *matches, const gint *scores, gint size,
+				const gint *ranked, gint ranked_size);
+const MosaicSearchResult *mosaic_search_cache_lookup (const gchar *query, guint generation);
+gint mosaic_search_top (const gint *matches, const gint *scores, gint n, gint k, gint *ranked);
+
+G_END_DECLS
+
+#endif /* MOSAIC_SEARCH_H */
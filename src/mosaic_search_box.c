@@ -177,32 +177,55 @@ mosaic_search_box_paint (MosaicSearchBox *box, cairo_t *cr, gint width, gint hei
 
   PangoLayout *pl;
   PangoFontDescription *pfd;
+  pfd = pango_font_description_from_string (MOSAIC_BOX (box)->font);
+
+  // Page indicator takes the right edge, text gets what is left.
+  gint text_width = width;
+  if (box->n_pages > 1) {
+    int iwidth, iheight;
+    gchar *indicator = g_strdup_printf ("%d/%d", box->page + 1, box->n_pages);
+    pl = pango_cairo_create_layout (cr);
+    pango_layout_set_text (pl, indicator, -1);
+    pango_layout_set_font_description (pl, pfd);
+    pango_layout_get_pixel_size (pl, &iwidth, &iheight);
+    cairo_set_source_rgba (cr, 0.5, 0.5, 0.5, 1.0);
+    cairo_move_to (cr, width-iwidth-5, (height-iheight)/2);
+    pango_cairo_show_layout (cr, pl);
+    g_object_unref (pl);
+    g_free (indicator);
+    text_width -= iwidth + 5;
+  }
+
   pl = pango_cairo_create_layout (cr);
   pango_layout_set_text (pl, MOSAIC_BOX (box)->name, -1);
-  pfd = pango_font_description_from_string (MOSAIC_BOX (box)->font);
   pango_layout_set_font_description (pl, pfd);
   pango_font_description_free (pfd);
 
   int pwidth, pheight;
   pango_layout_get_pixel_size (pl, &pwidth, &pheight);
 
+  cairo_save (cr);
+  cairo_rectangle (cr, 0, 0, text_width, height);
+  cairo_clip (cr);
   cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, 1.0);
 
-  if ((width-pwidth) < 10)
-    cairo_move_to (cr, width-pwidth-5, (height-pheight)/2);
+  if ((text_width-pwidth) < 10)
+    cairo_move_to (cr, text_width-pwidth-5, (height-pheight)/2);
   else
     cairo_move_to (cr, 5, (height-pheight)/2);
 
   pango_cairo_show_layout (cr, pl);
   g_object_unref (pl);
 
-  if ((width-pwidth) < 10)
-    cairo_rectangle (cr, width-4, 5, 2, height-10);
+  if ((text_width-pwidth) < 10)
+    cairo_rectangle (cr, text_width-4, 5, 2, height-10);
   else
     cairo_rectangle (cr, pwidth+6, 5, 2, height-10);
   cairo_fill (cr);
+  cairo_restore (cr);
 
-  mosaic_box_paint (MOSAIC_BOX (box), cr, width, height);
+  mosaic_box_paint (MOSAIC_BOX (box), cr, width, height,
+		    mosaic_box_get_state (MOSAIC_BOX (box)));
 }
 
 static void mosaic_search_box_size_request (GtkWidget *widget, GtkRequisition *requisition)
@@ -274,3 +297,16 @@ void mosaic_search_box_kill_word (MosaicSearchBox *box)
     mosaic_search_box_remove_symbols (box, len);
   }
 }
+
+// Shows "page/n_pages" at the right edge when there is more than one page.
+void mosaic_search_box_set_page_info (MosaicSearchBox *box, gint page, gint n_pages)
+{
+  g_return_if_fail (MOSAIC_IS_SEARCH_BOX (box));
+
+  if (box->page == page && box->n_pages == n_pages)
+    return;
+
+  box->page = page;
+  box->n_pages = n_pages;
+  gtk_widget_queue_draw (GTK_WIDGET (box));
+}
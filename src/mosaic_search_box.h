@@ -27,6 +27,8 @@ struct _MosaicSearchBox
 
   /*< private >*/
   gchar *cursor;
+  gint page;
+  gint n_pages;
 };
 
 struct _MosaicSearchBoxClass
@@ -43,6 +45,7 @@ const gchar *mosaic_search_box_get_text (MosaicSearchBox *box);
 void mosaic_search_box_append_text (MosaicSearchBox *box, const gchar *text);
 void mosaic_search_box_remove_symbols (MosaicSearchBox *box, guint size);
 void mosaic_search_box_kill_word (MosaicSearchBox *box);
+void mosaic_search_box_set_page_info (MosaicSearchBox *box, gint page, gint n_pages);
 
 G_END_DECLS
 
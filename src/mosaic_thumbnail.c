@@ -0,0 +1,551 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_thumbnail.c - live previews of windows.
+ *
+ * Window contents are taken from its Composite pixmap and scaled into
+ * a small pixmap by XRender, all on the server side. Only areas reported
+ * by Damage are scaled again, not more often than THUMBNAIL_MIN_INTERVAL
+ * for each window. Thumbnails have the visual of the box they are drawn
+ * into, which is ARGB when a compositing manager runs.
+ *
+ * Unmapped windows (minimized or on other desktops) have no pixmap, so
+ * the last seen thumbnail of every window is read back into a cache of
+ * 16-bit images, bounded by THUMBNAIL_CACHE_SIZE bytes. Readbacks are
+ * limited to THUMBNAIL_CAPTURES_PER_SECOND for all windows together.
+ *
+ * Capture state is kept by window until the window is destroyed, so it
+ * survives rebuilds of the box list; boxes only hold references to it.
+ */
+
+#include <gdk/gdkx.h>
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xrender.h>
+
+#include "mosaic_thumbnail.h"
+
+#define THUMBNAIL_MIN_INTERVAL 250 // milliseconds
+#define THUMBNAIL_CACHE_INTERVAL 2000 // milliseconds, between readbacks of one window
+#define THUMBNAIL_CAPTURES_PER_SECOND 8
+#define THUMBNAIL_CACHE_SIZE (4 << 20)
+
+struct _MosaicThumbnail
+{
+  Window xwindow;
+  guint ref_count; // Boxes showing it.
+  gboolean destroyed; // Window is gone, last contents are still shown.
+  GdkColormap *colormap;
+  gint max_width, max_height;
+  MosaicThumbnailUpdated updated;
+  gpointer data;
+
+  Damage damage;
+
+  /* Window contents, valid while the window is mapped. */
+  Pixmap window_pixmap;
+  Picture source;
+  gint window_width, window_height;
+  gdouble scale;
+
+  /* Scaled copy. */
+  GdkPixmap *pixmap;
+  Picture picture;
+  gint width, height;
+  gboolean captured;
+  gboolean live; // Contents came from the window, not from the cache.
+
+  /* Damaged area in window coordinates, waiting for refresh. */
+  GdkRectangle dirty;
+  gboolean has_dirty;
+  gint64 last_refresh;
+  guint refresh_source;
+};
+
+/* Last seen thumbnail in RGB565. */
+typedef struct {
+  Window xwindow;
+  gint width, height;
+  guint16 *pixels;
+  gint64 captured_at;
+  GList *link; // In cache_lru, most recent first.
+} CacheEntry;
+
+static gboolean initialized = FALSE;
+static gboolean available = FALSE;
+static int damage_event_base;
+static GHashTable *thumbnails = NULL; // Window -> MosaicThumbnail
+
+static GHashTable *cache = NULL; // Window -> CacheEntry
+static GQueue cache_lru = G_QUEUE_INIT;
+static gsize cache_bytes = 0;
+static gint64 budget_start = 0;
+static gint budget_used = 0;
+
+static GdkFilterReturn thumbnail_filter (GdkXEvent *gdk_xevent, GdkEvent *event, gpointer data);
+static void thumbnail_free (MosaicThumbnail *thumb);
+static void thumbnail_destroy (MosaicThumbnail *thumb);
+
+// Checks for needed extensions, returns FALSE if thumbnails can't be made.
+gboolean mosaic_thumbnail_init ()
+{
+  if (initialized)
+    return available;
+  initialized = TRUE;
+
+  Display *dpy = gdk_x11_get_default_xdisplay ();
+  int event_base, error_base;
+  int major = 0, minor = 2;
+
+  if (!XCompositeQueryExtension (dpy, &event_base, &error_base))
+    return FALSE;
+  // NameWindowPixmap appeared in 0.2.
+  XCompositeQueryVersion (dpy, &major, &minor);
+  if (major == 0 && minor < 2)
+    return FALSE;
+  if (!XDamageQueryExtension (dpy, &damage_event_base, &error_base))
+    return FALSE;
+  if (!XRenderQueryExtension (dpy, &event_base, &error_base))
+    return FALSE;
+
+  thumbnails = g_hash_table_new (g_direct_hash, g_direct_equal);
+  cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+  gdk_window_add_filter (NULL, (GdkFilterFunc) thumbnail_filter, NULL);
+  available = TRUE;
+
+  return TRUE;
+}
+
+static void thumbnail_release_source (MosaicThumbnail *thumb)
+{
+  Display *dpy = gdk_x11_get_default_xdisplay ();
+
+  if (thumb->source)
+    XRenderFreePicture (dpy, thumb->source);
+  if (thumb->window_pixmap)
+    XFreePixmap (dpy, thumb->window_pixmap);
+  thumb->source = None;
+  thumb->window_pixmap = None;
+}
+
+static void cache_remove (CacheEntry *entry)
+{
+  g_hash_table_remove (cache, GUINT_TO_POINTER (entry->xwindow));
+  g_queue_delete_link (&cache_lru, entry->link);
+  cache_bytes -= entry->width * entry->height * sizeof (guint16);
+  g_free (entry->pixels);
+  g_free (entry);
+}
+
+static gboolean cache_budget_take ()
+{
+  gint64 now = g_get_monotonic_time ();
+
+  if (now - budget_start >= G_USEC_PER_SEC) {
+    budget_start = now;
+    budget_used = 0;
+  }
+  if (budget_used >= THUMBNAIL_CAPTURES_PER_SECOND)
+    return FALSE;
+
+  budget_used++;
+  return TRUE;
+}
+
+/* Reads the thumbnail back into the cache. Unless forced, it is skipped
+ * when the cached copy is recent or the budget is spent. */
+static void cache_store (MosaicThumbnail *thumb, gboolean force)
+{
+  if (!thumb->live)
+    return;
+
+  gint64 now = g_get_monotonic_time ();
+  CacheEntry *entry = g_hash_table_lookup (cache, GUINT_TO_POINTER (thumb->xwindow));
+  if (!force &&
+      ((entry && now - entry->captured_at < THUMBNAIL_CACHE_INTERVAL * 1000) ||
+       !cache_budget_take ()))
+    return;
+
+  GdkPixbuf *pixbuf = gdk_pixbuf_get_from_drawable (NULL, thumb->pixmap, NULL,
+						    0, 0, 0, 0, thumb->width, thumb->height);
+  if (!pixbuf)
+    return;
+
+  if (entry)
+    cache_remove (entry);
+
+  entry = g_new0 (CacheEntry, 1);
+  entry->xwindow = thumb->xwindow;
+  entry->width = thumb->width;
+  entry->height = thumb->height;
+  entry->pixels = g_new (guint16, entry->width * entry->height);
+  entry->captured_at = now;
+
+  gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  gint n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  const guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  guint16 *out = entry->pixels;
+  for (int y = 0; y < entry->height; y++) {
+    const guchar *p = pixels + y * rowstride;
+    for (int x = 0; x < entry->width; x++, p += n_channels)
+      *out++ = ((p[0] >> 3) << 11) | ((p[1] >> 2) << 5) | (p[2] >> 3);
+  }
+  g_object_unref (pixbuf);
+
+  g_queue_push_head (&cache_lru, entry);
+  entry->link = cache_lru.head;
+  g_hash_table_insert (cache, GUINT_TO_POINTER (entry->xwindow), entry);
+  cache_bytes += entry->width * entry->height * sizeof (guint16);
+
+  while (cache_bytes > THUMBNAIL_CACHE_SIZE && cache_lru.length > 1)
+    cache_remove (g_queue_peek_tail (&cache_lru));
+}
+
+static void thumbnail_set_size (MosaicThumbnail *thumb, gint width, gint height)
+{
+  Display *dpy = gdk_x11_get_default_xdisplay ();
+
+  if (thumb->pixmap && thumb->width == width && thumb->height == height)
+    return;
+
+  if (thumb->pixmap) {
+    XRenderFreePicture (dpy, thumb->picture);
+    g_object_unref (thumb->pixmap);
+  }
+  GdkVisual *visual = gdk_colormap_get_visual (thumb->colormap);
+  thumb->pixmap = gdk_pixmap_new (NULL, width, height, visual->depth);
+  // Needed to read it back and to draw cached pixbufs.
+  gdk_drawable_set_colormap (thumb->pixmap, thumb->colormap);
+  thumb->picture = XRenderCreatePicture (dpy, GDK_PIXMAP_XID (thumb->pixmap),
+					 XRenderFindVisualFormat (dpy, GDK_VISUAL_XVISUAL (visual)),
+					 0, NULL);
+  thumb->width = width;
+  thumb->height = height;
+  thumb->captured = FALSE;
+  thumb->live = FALSE;
+}
+
+// Fills the thumbnail with the last seen contents of its window.
+static void cache_load (MosaicThumbnail *thumb)
+{
+  CacheEntry *entry = g_hash_table_lookup (cache, GUINT_TO_POINTER (thumb->xwindow));
+  if (!entry)
+    return;
+
+  GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, entry->width, entry->height);
+  gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  const guint16 *in = entry->pixels;
+  for (int y = 0; y < entry->height; y++) {
+    guchar *p = pixels + y * rowstride;
+    for (int x = 0; x < entry->width; x++, p += 3, in++) {
+      p[0] = ((*in >> 11) & 0x1f) << 3;
+      p[1] = ((*in >> 5) & 0x3f) << 2;
+      p[2] = (*in & 0x1f) << 3;
+    }
+  }
+
+  // Cached copy may come from a box of other size.
+  gdouble scale = MIN (1.0, MIN ((gdouble) thumb->max_width / entry->width,
+				 (gdouble) thumb->max_height / entry->height));
+  gint width = MAX (1, entry->width * scale);
+  gint height = MAX (1, entry->height * scale);
+  if (width != entry->width || height != entry->height) {
+    GdkPixbuf *scaled = gdk_pixbuf_scale_simple (pixbuf, width, height, GDK_INTERP_BILINEAR);
+    g_object_unref (pixbuf);
+    pixbuf = scaled;
+  }
+
+  thumbnail_set_size (thumb, width, height);
+  // Cairo fills alpha of ARGB pixmaps too, gdk_draw_pixbuf would leave it clear.
+  cairo_t *cr = gdk_cairo_create (thumb->pixmap);
+  gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+  g_object_unref (pixbuf);
+
+  thumb->captured = TRUE;
+  thumb->live = FALSE;
+
+  // Recently shown entries are kept longer.
+  g_queue_unlink (&cache_lru, entry->link);
+  g_queue_push_head_link (&cache_lru, entry->link);
+}
+
+static void thumbnail_damage (MosaicThumbnail *thumb, gint x, gint y, gint width, gint height)
+{
+  GdkRectangle area = { x, y, width, height };
+
+  if (thumb->has_dirty)
+    gdk_rectangle_union (&thumb->dirty, &area, &thumb->dirty);
+  else
+    thumb->dirty = area;
+  thumb->has_dirty = TRUE;
+}
+
+// Names pixmap of the mapped window and sets up scaling from it.
+static void thumbnail_bind_source (MosaicThumbnail *thumb)
+{
+  Display *dpy = gdk_x11_get_default_xdisplay ();
+  XWindowAttributes attrs;
+
+  if (!XGetWindowAttributes (dpy, thumb->xwindow, &attrs) ||
+      attrs.map_state != IsViewable || attrs.width <= 0 || attrs.height <= 0)
+    return;
+
+  XRenderPictFormat *format = XRenderFindVisualFormat (dpy, attrs.visual);
+  if (!format)
+    return;
+
+  thumb->window_pixmap = XCompositeNameWindowPixmap (dpy, thumb->xwindow);
+  XRenderPictureAttributes pa;
+  pa.subwindow_mode = IncludeInferiors;
+  thumb->source = XRenderCreatePicture (dpy, thumb->window_pixmap, format, CPSubwindowMode, &pa);
+  XRenderSetPictureFilter (dpy, thumb->source, FilterBilinear, NULL, 0);
+  thumb->window_width = attrs.width;
+  thumb->window_height = attrs.height;
+
+  // Keep aspect ratio of the window.
+  thumb->scale = MIN ((gdouble) thumb->max_width / attrs.width,
+		      (gdouble) thumb->max_height / attrs.height);
+  gint width = MAX (1, attrs.width * thumb->scale);
+  gint height = MAX (1, attrs.height * thumb->scale);
+
+  thumbnail_set_size (thumb, width, height);
+
+  XTransform transform = {{
+      { XDoubleToFixed (1.0 / thumb->scale), 0, 0 },
+      { 0, XDoubleToFixed (1.0 / thumb->scale), 0 },
+      { 0, 0, XDoubleToFixed (1.0) }
+    }};
+  XRenderSetPictureTransform (dpy, thumb->source, &transform);
+
+  thumbnail_damage (thumb, 0, 0, attrs.width, attrs.height);
+}
+
+static gboolean thumbnail_refresh (gpointer data)
+{
+  MosaicThumbnail *thumb = (MosaicThumbnail *) data;
+  Display *dpy = gdk_x11_get_default_xdisplay ();
+  gboolean updated = FALSE;
+
+  thumb->refresh_source = 0;
+  thumb->last_refresh = g_get_monotonic_time ();
+
+  gdk_error_trap_push ();
+  if (!thumb->source)
+    thumbnail_bind_source (thumb);
+
+  if (thumb->source && thumb->has_dirty) {
+    // Scale only the damaged area, widened by a pixel for the filter.
+    gint x1 = CLAMP ((gint) (thumb->dirty.x * thumb->scale) - 1, 0, thumb->width);
+    gint y1 = CLAMP ((gint) (thumb->dirty.y * thumb->scale) - 1, 0, thumb->height);
+    gint x2 = CLAMP ((gint) ((thumb->dirty.x + thumb->dirty.width) * thumb->scale) + 2, 0, thumb->width);
+    gint y2 = CLAMP ((gint) ((thumb->dirty.y + thumb->dirty.height) * thumb->scale) + 2, 0, thumb->height);
+    if (x2 > x1 && y2 > y1) {
+      XRenderComposite (dpy, PictOpSrc, thumb->source, None, thumb->picture,
+			x1, y1, 0, 0, x1, y1, x2 - x1, y2 - y1);
+      updated = TRUE;
+    }
+  }
+  thumb->has_dirty = FALSE;
+
+  gdk_flush ();
+  if (gdk_error_trap_pop ()) {
+    // Window was unmapped or destroyed meanwhile.
+    gdk_error_trap_push ();
+    thumbnail_release_source (thumb);
+    gdk_flush ();
+    gdk_error_trap_pop ();
+  } else if (updated) {
+    thumb->captured = TRUE;
+    thumb->live = TRUE;
+    cache_store (thumb, FALSE);
+    if (thumb->updated)
+      thumb->updated (thumb->data);
+  }
+
+  return FALSE;
+}
+
+static void thumbnail_schedule (MosaicThumbnail *thumb)
+{
+  if (thumb->refresh_source)
+    return;
+
+  gint64 wait = thumb->last_refresh + THUMBNAIL_MIN_INTERVAL * 1000 - g_get_monotonic_time ();
+  thumb->refresh_source = g_timeout_add (MAX (wait / 1000, 0), thumbnail_refresh, thumb);
+}
+
+static GdkFilterReturn thumbnail_filter (GdkXEvent *gdk_xevent, GdkEvent *event, gpointer data)
+{
+  XEvent *xevent = (XEvent *) gdk_xevent;
+  MosaicThumbnail *thumb;
+
+  if (xevent->type == damage_event_base + XDamageNotify) {
+    XDamageNotifyEvent *ev = (XDamageNotifyEvent *) xevent;
+    thumb = g_hash_table_lookup (thumbnails, GUINT_TO_POINTER (ev->drawable));
+    if (thumb) {
+      XDamageSubtract (ev->display, ev->damage, None, None);
+      thumbnail_damage (thumb, ev->area.x, ev->area.y, ev->area.width, ev->area.height);
+      thumbnail_schedule (thumb);
+    }
+  } else if (xevent->type == ConfigureNotify) {
+    thumb = g_hash_table_lookup (thumbnails, GUINT_TO_POINTER (xevent->xconfigure.window));
+    // Resized window gets a new pixmap.
+    if (thumb && thumb->source &&
+	(xevent->xconfigure.width != thumb->window_width ||
+	 xevent->xconfigure.height != thumb->window_height)) {
+      thumbnail_release_source (thumb);
+      thumbnail_schedule (thumb);
+    }
+  } else if (xevent->type == MapNotify) {
+    thumb = g_hash_table_lookup (thumbnails, GUINT_TO_POINTER (xevent->xmap.window));
+    if (thumb)
+      thumbnail_schedule (thumb);
+  } else if (xevent->type == UnmapNotify) {
+    // Last captured contents are kept, and saved for later boxes.
+    thumb = g_hash_table_lookup (thumbnails, GUINT_TO_POINTER (xevent->xunmap.window));
+    if (thumb) {
+      cache_store (thumb, TRUE);
+      thumbnail_release_source (thumb);
+    }
+  } else if (xevent->type == DestroyNotify) {
+    thumb = g_hash_table_lookup (thumbnails, GUINT_TO_POINTER (xevent->xdestroywindow.window));
+    if (thumb)
+      thumbnail_destroy (thumb);
+    CacheEntry *entry = g_hash_table_lookup (cache, GUINT_TO_POINTER (xevent->xdestroywindow.window));
+    if (entry)
+      cache_remove (entry);
+  }
+
+  return GDK_FILTER_CONTINUE;
+}
+
+// Drops the scaled copy, it is made again on the next refresh.
+static void thumbnail_drop_pixmap (MosaicThumbnail *thumb)
+{
+  if (thumb->pixmap) {
+    XRenderFreePicture (gdk_x11_get_default_xdisplay (), thumb->picture);
+    g_object_unref (thumb->pixmap);
+  }
+  thumb->pixmap = NULL;
+  thumb->picture = None;
+  thumb->width = thumb->height = 0;
+  thumb->captured = FALSE;
+  thumb->live = FALSE;
+}
+
+/* Returns thumbnail of the window, made with the visual of colormap to
+ * be drawn into windows of it. Capture starts right away, whether the
+ * box is exposed or not. */
+MosaicThumbnail *mosaic_thumbnail_get (Window xwindow, GdkColormap *colormap,
+				       gint max_width, gint max_height,
+				       MosaicThumbnailUpdated updated, gpointer data)
+{
+  g_return_val_if_fail (available, NULL);
+  g_return_val_if_fail (max_width > 0 && max_height > 0, NULL);
+
+  Display *dpy = gdk_x11_get_default_xdisplay ();
+  MosaicThumbnail *thumb = g_hash_table_lookup (thumbnails, GUINT_TO_POINTER (xwindow));
+
+  if (!thumb) {
+    thumb = g_new0 (MosaicThumbnail, 1);
+    thumb->xwindow = xwindow;
+    g_hash_table_insert (thumbnails, GUINT_TO_POINTER (xwindow), thumb);
+
+    gdk_error_trap_push ();
+    XCompositeRedirectWindow (dpy, xwindow, CompositeRedirectAutomatic);
+    thumb->damage = XDamageCreate (dpy, xwindow, XDamageReportBoundingBox);
+    gdk_flush ();
+    gdk_error_trap_pop ();
+  } else if (thumb->colormap != colormap ||
+	     thumb->max_width != max_width || thumb->max_height != max_height) {
+    // Other box size or visual, scale again from the window.
+    thumbnail_release_source (thumb);
+    thumbnail_drop_pixmap (thumb);
+  }
+
+  if (thumb->colormap != colormap) {
+    if (thumb->colormap)
+      g_object_unref (thumb->colormap);
+    thumb->colormap = g_object_ref (colormap);
+  }
+  thumb->max_width = max_width;
+  thumb->max_height = max_height;
+  thumb->updated = updated;
+  thumb->data = data;
+  thumb->ref_count++;
+
+  gdk_error_trap_push ();
+  XWindowAttributes attrs;
+  // Keep events already selected, make sure of resizes and (un)mapping.
+  if (XGetWindowAttributes (dpy, xwindow, &attrs))
+    XSelectInput (dpy, xwindow, attrs.your_event_mask | StructureNotifyMask);
+  gdk_flush ();
+  gdk_error_trap_pop ();
+
+  // Shown until the window can be captured, if ever.
+  if (!thumb->captured)
+    cache_load (thumb);
+  if (!thumb->source)
+    thumbnail_schedule (thumb);
+
+  return thumb;
+}
+
+// Detaches the box which got it with data, the thumbnail stays with the window.
+void mosaic_thumbnail_release (MosaicThumbnail *thumb, gpointer data)
+{
+  g_return_if_fail (thumb != NULL && thumb->ref_count > 0);
+
+  if (thumb->data == data) {
+    thumb->updated = NULL;
+    thumb->data = NULL;
+  }
+  if (!--thumb->ref_count && thumb->destroyed)
+    thumbnail_free (thumb);
+}
+
+static void thumbnail_free (MosaicThumbnail *thumb)
+{
+  thumbnail_drop_pixmap (thumb);
+  g_object_unref (thumb->colormap);
+  g_free (thumb);
+}
+
+static void thumbnail_destroy (MosaicThumbnail *thumb)
+{
+  Display *dpy = gdk_x11_get_default_xdisplay ();
+
+  if (thumb->refresh_source)
+    g_source_remove (thumb->refresh_source);
+  thumb->refresh_source = 0;
+  g_hash_table_remove (thumbnails, GUINT_TO_POINTER (thumb->xwindow));
+
+  gdk_error_trap_push ();
+  if (thumb->damage)
+    XDamageDestroy (dpy, thumb->damage);
+  thumb->damage = None;
+  thumbnail_release_source (thumb);
+  XCompositeUnredirectWindow (dpy, thumb->xwindow, CompositeRedirectAutomatic);
+  gdk_flush ();
+  gdk_error_trap_pop ();
+
+  // Boxes of the window are dropped with the next list update.
+  thumb->destroyed = TRUE;
+  if (!thumb->ref_count)
+    thumbnail_free (thumb);
+}
+
+// Returns scaled window contents, or NULL if nothing was captured yet.
+GdkPixmap *mosaic_thumbnail_get_pixmap (MosaicThumbnail *thumb, gint *width, gint *height)
+{
+  g_return_val_if_fail (thumb != NULL, NULL);
+
+  if (!thumb->captured)
+    return NULL;
+
+  *width = thumb->width;
+  *height = thumb->height;
+  return thumb->pixmap;
+}
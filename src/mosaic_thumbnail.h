@@ -0,0 +1,28 @@
+/* Copyright (c) 2012, Anton S. Lobashev
+ * mosaic_thumbnail.h - live previews of windows.
+ */
+
+#ifndef MOSAIC_THUMBNAIL_H
+#define MOSAIC_THUMBNAIL_H
+
+#include <gtk/gtk.h>
+#include <X11/Xlib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MosaicThumbnail MosaicThumbnail;
+
+/* Thumbnails are kept per window until it is destroyed, so they outlive
+ * boxes. Called after the thumbnail pixmap got new contents. */
+typedef void (* MosaicThumbnailUpdated) (gpointer data);
+
+gboolean mosaic_thumbnail_init ();
+MosaicThumbnail *mosaic_thumbnail_get (Window xwindow, GdkColormap *colormap,
+				       gint max_width, gint max_height,
+				       MosaicThumbnailUpdated updated, gpointer data);
+void mosaic_thumbnail_release (MosaicThumbnail *thumb, gpointer data);
+GdkPixmap *mosaic_thumbnail_get_pixmap (MosaicThumbnail *thumb, gint *width, gint *height);
+
+G_END_DECLS
+
+#endif /* MOSAIC_THUMBNAIL_H */
@@ -26,10 +26,31 @@ static void mosaic_window_box_get_property (GObject *gobject,
 					    GValue *value,
 					    GParamSpec *pspec);
 
+static void mosaic_window_box_unrealize (GtkWidget *widget);
+#ifdef X11
+static void mosaic_window_box_realize (GtkWidget *widget);
+static void mosaic_window_box_size_allocate (GtkWidget *widget, GtkAllocation *allocation);
+#endif
 static gboolean mosaic_window_box_expose_event (GtkWidget *widget, GdkEventExpose *event);
-static void mosaic_window_box_paint (MosaicWindowBox *box, cairo_t *cr, gint width, gint height);
+static void paint_fill (cairo_t *cr, gdouble r, gdouble g, gdouble b,
+			gint width, gint height, MosaicBoxState state);
+static void mosaic_window_box_paint_placeholder (MosaicWindowBox *box, cairo_t *cr, gint width, gint height,
+						 MosaicBoxState state);
+static void mosaic_window_box_queue_tile_job (MosaicWindowBox *box);
+static gboolean tile_job_done (gpointer data);
+static GdkPixmap *mosaic_window_box_get_tile (MosaicWindowBox *box, MosaicBoxState state);
+static void mosaic_window_box_drop_tiles (MosaicWindowBox *box);
+static void mosaic_window_box_invalidate_tiles (MosaicWindowBox *box);
+static void mosaic_window_box_font_changed (MosaicBox *box);
 static void mosaic_window_box_create_colors (MosaicWindowBox *box);
-static void mosaic_window_box_setup_icon (MosaicWindowBox *box, GdkPixbuf *pixbuf);
+static void mosaic_window_box_setup_icon (MosaicWindowBox *box, MosaicIcon *icon);
+static MosaicIcon *load_theme_icon (const gchar *name, guint size);
+static void mosaic_window_box_update_search_key (MosaicWindowBox *box);
+#ifdef X11
+static void mosaic_window_box_update_thumbnail (MosaicWindowBox *box);
+static void mosaic_window_box_paint_thumbnail (MosaicWindowBox *box);
+static void mosaic_window_box_drop_thumbnail (MosaicWindowBox *box);
+#endif
 
 static GParamSpec *obj_properties[N_PROPERTIES] = { NULL };
 
@@ -49,8 +70,15 @@ mosaic_window_box_class_init (MosaicWindowBoxClass *klass)
   gobject_class->set_property = mosaic_window_box_set_property;
   gobject_class->get_property = mosaic_window_box_get_property;
 
+  widget_class->unrealize = mosaic_window_box_unrealize;
+#ifdef X11
+  widget_class->realize = mosaic_window_box_realize;
+  widget_class->size_allocate = mosaic_window_box_size_allocate;
+#endif
   widget_class->expose_event = mosaic_window_box_expose_event;
 
+  MOSAIC_BOX_CLASS (klass)->font_changed = mosaic_window_box_font_changed;
+
   obj_properties[PROP_IS_WINDOW] =
     g_param_spec_boolean ("is-window",
 			  "Is window",
@@ -101,12 +129,25 @@ mosaic_window_box_init (MosaicWindowBox *box)
 {
   gtk_widget_set_can_focus (GTK_WIDGET (box), TRUE);
   gtk_widget_set_receives_default (GTK_WIDGET (box), TRUE);
+  // Tiles cover the whole box, expose is a single copy to the window.
+  gtk_widget_set_double_buffered (GTK_WIDGET (box), FALSE);
 
   box->opt_name = NULL;
-  box->icon_pixbuf = NULL;
-  box->icon_surface = NULL;
-  box->icon_context = NULL;
+  box->icon = NULL;
   box->desktop = -1;
+
+  for (int i = 0; i < MOSAIC_BOX_N_STATES; i++) {
+    box->tiles [i] = NULL;
+    box->tile_images [i] = NULL;
+  }
+  box->tile_width = box->tile_height = 0;
+  box->tile_serial = 0;
+  box->tile_job_pending = FALSE;
+#ifdef X11
+  box->show_thumbnail = FALSE;
+  box->thumbnail = NULL;
+  box->thumbnail_width = box->thumbnail_height = 0;
+#endif
 }
 
 static GObject*	mosaic_window_box_constructor (GType gtype,
@@ -126,6 +167,7 @@ static GObject*	mosaic_window_box_constructor (GType gtype,
 #ifdef X11
     box->desktop = get_window_desktop (box->xwindow);
 #endif
+    mosaic_window_box_update_search_key (box);
   }
   box->show_desktop = FALSE;
   box->show_titles = TRUE;
@@ -160,16 +202,16 @@ mosaic_window_box_dispose (GObject *gobject)
   if (box->opt_name)
     g_free (box->opt_name);
   box->opt_name = NULL;
+  mosaic_search_key_clear (&box->search_key);
 
-  if (box->icon_context) {
-    cairo_destroy (box->icon_context);
-    cairo_surface_destroy (box->icon_surface);
-    box->icon_context = NULL;
-    box->icon_surface = NULL;
-  }
-  if (box->icon_pixbuf)
-    g_object_unref (box->icon_pixbuf);
-  box->icon_pixbuf = NULL;
+  if (box->icon)
+    mosaic_icon_unref (box->icon);
+  box->icon = NULL;
+
+  mosaic_window_box_invalidate_tiles (box);
+#ifdef X11
+  mosaic_window_box_drop_thumbnail (box);
+#endif
 
   G_OBJECT_CLASS (mosaic_window_box_parent_class)->dispose (gobject);
 }
@@ -236,98 +278,285 @@ static void mosaic_window_box_get_property (GObject *gobject,
   }
 }
 
+#ifdef X11
+// Placed boxes are realized and allocated, their previews are captured from then on.
+static void mosaic_window_box_realize (GtkWidget *widget)
+{
+  GTK_WIDGET_CLASS (mosaic_window_box_parent_class)->realize (widget);
+  mosaic_window_box_update_thumbnail (MOSAIC_WINDOW_BOX (widget));
+}
+
+static void mosaic_window_box_size_allocate (GtkWidget *widget, GtkAllocation *allocation)
+{
+  GTK_WIDGET_CLASS (mosaic_window_box_parent_class)->size_allocate (widget, allocation);
+  mosaic_window_box_update_thumbnail (MOSAIC_WINDOW_BOX (widget));
+}
+#endif
+
+static void mosaic_window_box_unrealize (GtkWidget *widget)
+{
+  // Tiles are tied to the screen of the widget's window.
+  mosaic_window_box_invalidate_tiles (MOSAIC_WINDOW_BOX (widget));
+#ifdef X11
+  mosaic_window_box_drop_thumbnail (MOSAIC_WINDOW_BOX (widget));
+#endif
+
+  GTK_WIDGET_CLASS (mosaic_window_box_parent_class)->unrealize (widget);
+}
+
 static gboolean
 mosaic_window_box_expose_event (GtkWidget *widget, GdkEventExpose *event)
 {
   g_return_val_if_fail (MOSAIC_IS_WINDOW_BOX (widget), FALSE);
 
-  cairo_t *cr;
-  cr = gdk_cairo_create (widget->window);
-  cairo_rectangle (cr,
-		   event->area.x, event->area.y,
-		   event->area.width, event->area.height);
-  cairo_clip (cr);
-  mosaic_window_box_paint (MOSAIC_WINDOW_BOX (widget), cr, widget->allocation.width, widget->allocation.height);
-  cairo_destroy (cr);
+  MosaicWindowBox *box = MOSAIC_WINDOW_BOX (widget);
+  MosaicBoxState state = mosaic_box_get_state (MOSAIC_BOX (box));
+  GdkPixmap *tile = mosaic_window_box_get_tile (box, state);
+
+  if (tile) {
+    // Focus and hover changes only cost a copy of the ready tile.
+    gdk_draw_drawable (widget->window, widget->style->black_gc, tile,
+		       event->area.x, event->area.y,
+		       event->area.x, event->area.y,
+		       event->area.width, event->area.height);
+  } else {
+    cairo_t *cr;
+    cr = gdk_cairo_create (widget->window);
+    cairo_rectangle (cr,
+		     event->area.x, event->area.y,
+		     event->area.width, event->area.height);
+    cairo_clip (cr);
+    mosaic_window_box_paint_placeholder (box, cr, widget->allocation.width, widget->allocation.height, state);
+    cairo_destroy (cr);
+  }
+#ifdef X11
+  if (box->show_thumbnail && box->is_window)
+    mosaic_window_box_paint_thumbnail (box);
+#endif
   return TRUE;
 }
 
-static void
-mosaic_window_box_paint (MosaicWindowBox *box, cairo_t *cr, gint width, gint height)
+#ifdef X11
+static void thumbnail_updated (gpointer data)
+{
+  gtk_widget_queue_draw (GTK_WIDGET (data));
+}
+
+/* Attaches the box to the preview of its window, sized to the right half
+ * of the box, which tiles leave to it. */
+static void mosaic_window_box_update_thumbnail (MosaicWindowBox *box)
+{
+  GtkWidget *widget = GTK_WIDGET (box);
+  gint max_width = widget->allocation.width / 2;
+  gint max_height = widget->allocation.height - 6;
+
+  if (!box->show_thumbnail || !box->is_window || !gtk_widget_get_realized (widget))
+    return;
+  if (box->thumbnail &&
+      box->thumbnail_width == max_width && box->thumbnail_height == max_height)
+    return;
+
+  mosaic_window_box_drop_thumbnail (box);
+  if (max_width <= 0 || max_height <= 0)
+    return;
+  box->thumbnail = mosaic_thumbnail_get (box->xwindow, gdk_drawable_get_colormap (widget->window),
+					 max_width, max_height, thumbnail_updated, box);
+  box->thumbnail_width = max_width;
+  box->thumbnail_height = max_height;
+}
+
+static void mosaic_window_box_paint_thumbnail (MosaicWindowBox *box)
+{
+  GtkWidget *widget = GTK_WIDGET (box);
+  gint max_width = box->thumbnail_width;
+
+  gint width, height;
+  GdkPixmap *pixmap = box->thumbnail ? mosaic_thumbnail_get_pixmap (box->thumbnail, &width, &height) : NULL;
+  if (pixmap)
+    gdk_draw_drawable (widget->window, widget->style->black_gc, pixmap,
+		       0, 0,
+		       widget->allocation.width - max_width - 3 + (max_width - width)/2,
+		       (widget->allocation.height - height)/2,
+		       width, height);
+}
+
+static void mosaic_window_box_drop_thumbnail (MosaicWindowBox *box)
+{
+  if (box->thumbnail)
+    mosaic_thumbnail_release (box->thumbnail, box);
+  box->thumbnail = NULL;
+  box->thumbnail_width = box->thumbnail_height = 0;
+}
+#endif
+
+// Returns tile for the given state or NULL if it is still being rendered.
+static GdkPixmap *mosaic_window_box_get_tile (MosaicWindowBox *box, MosaicBoxState state)
+{
+  GtkWidget *widget = GTK_WIDGET (box);
+  gint width = widget->allocation.width;
+  gint height = widget->allocation.height;
+
+  if (box->tile_width != width || box->tile_height != height) {
+    // We are already exposing, no need to queue another draw.
+    mosaic_window_box_drop_tiles (box);
+    box->tile_width = width;
+    box->tile_height = height;
+  }
+
+  if (width <= 0 || height <= 0)
+    return NULL;
+
+  if (!box->tiles [state] && box->tile_images [state]) {
+    cairo_t *cr;
+    box->tiles [state] = gdk_pixmap_new (widget->window, width, height, -1);
+    cr = gdk_cairo_create (box->tiles [state]);
+    cairo_set_source_surface (cr, box->tile_images [state], 0, 0);
+    cairo_paint (cr);
+    // Icons live on the server, so they are composited here.
+    if (box->has_icon && box->icon)
+      mosaic_icon_paint (box->icon, cr, 5, (height - box->icon->height)/2);
+    cairo_destroy (cr);
+
+    cairo_surface_destroy (box->tile_images [state]);
+    box->tile_images [state] = NULL;
+  }
+
+  if (!box->tiles [state] && !box->tile_job_pending)
+    mosaic_window_box_queue_tile_job (box);
+
+  return box->tiles [state];
+}
+
+static void mosaic_window_box_drop_tiles (MosaicWindowBox *box)
+{
+  for (int i = 0; i < MOSAIC_BOX_N_STATES; i++) {
+    if (box->tiles [i]) {
+      g_object_unref (box->tiles [i]);
+      box->tiles [i] = NULL;
+    }
+    if (box->tile_images [i]) {
+      cairo_surface_destroy (box->tile_images [i]);
+      box->tile_images [i] = NULL;
+    }
+  }
+  box->tile_width = box->tile_height = 0;
+  // Results of the job in flight are stale now.
+  box->tile_serial++;
+  box->tile_job_pending = FALSE;
+}
+
+// Drops rendered tiles, so they will be rendered again on next expose.
+static void mosaic_window_box_invalidate_tiles (MosaicWindowBox *box)
+{
+  mosaic_window_box_drop_tiles (box);
+  gtk_widget_queue_draw (GTK_WIDGET (box));
+}
+
+static void mosaic_window_box_font_changed (MosaicBox *box)
 {
-  gboolean has_focus = gtk_widget_has_focus (GTK_WIDGET (box));
-  if (MOSAIC_BOX (box)->on_box)
-    cairo_set_source_rgb (cr, box->r-0.2, box->g-0.2, box->b-0.2);
-  else if (has_focus)
-    cairo_set_source_rgb (cr, box->r-0.4, box->g-0.4, box->b-0.4);
+  mosaic_window_box_invalidate_tiles (MOSAIC_WINDOW_BOX (box));
+}
+
+static void paint_fill (cairo_t *cr, gdouble r, gdouble g, gdouble b,
+			gint width, gint height, MosaicBoxState state)
+{
+  if (state & MOSAIC_BOX_STATE_HOVER)
+    cairo_set_source_rgb (cr, r-0.2, g-0.2, b-0.2);
+  else if (state & MOSAIC_BOX_STATE_FOCUSED)
+    cairo_set_source_rgb (cr, r-0.4, g-0.4, b-0.4);
   else
-    cairo_set_source_rgb (cr, box->r, box->g, box->b);
+    cairo_set_source_rgb (cr, r, g, b);
   cairo_rectangle (cr, 0, 0, width, height);
   cairo_fill (cr);
+}
 
-  PangoLayout *pl;
-  PangoFontDescription *pfd;
-  pl = pango_cairo_create_layout (cr);
+// Shown for a frame or so, until the tile comes from the workers.
+static void mosaic_window_box_paint_placeholder (MosaicWindowBox *box, cairo_t *cr, gint width, gint height,
+						 MosaicBoxState state)
+{
+  paint_fill (cr, box->r, box->g, box->b, width, height, state);
+  mosaic_box_paint (MOSAIC_BOX (box), cr, width, height, state);
+}
 
-  /* Shall we draw the desktop number */
-  if (box->show_desktop) {
-    gchar desk [4] = { 0 };
-    if (box->desktop > -1)
-      sprintf (desk, "%d", box->desktop+1);
-    else
-      sprintf (desk, "A");
+/* Tile rasterization.
+ *
+ * Fill, desktop number, title and border of all states are rendered
+ * into image surfaces by a pool of worker threads, each with its own
+ * font map. Job carries a snapshot of everything it needs, so workers
+ * never touch the widget itself; main thread uploads the images and
+ * composites icons from the atlas.
+ */
 
-    pango_layout_set_text (pl, desk, -1);
-    pfd = pango_font_description_from_string (MOSAIC_BOX (box)->font);
-    pango_font_description_set_weight (pfd, PANGO_WEIGHT_BOLD);
-    pango_font_description_set_size (pfd, (height-10) * PANGO_SCALE);
-    pango_layout_set_font_description (pl, pfd);
-    pango_font_description_free (pfd);
+typedef struct {
+  MosaicWindowBox *box;
+  guint serial;
+  gint width, height;
+  gdouble r, g, b;
+  gchar *name;
+  gchar *font;
+  cairo_font_options_t *font_options;
+  gboolean show_desktop;
+  gboolean show_titles;
+  gint desktop;
+  gint icon_width;
+  gint thumbnail_width; // Right side kept free for the preview.
+  cairo_surface_t *images [MOSAIC_BOX_N_STATES];
+} TileJob;
+
+static GThreadPool *tile_pool = NULL;
+static GPrivate font_map_key = G_PRIVATE_INIT (g_object_unref);
+
+static void tile_job_free (TileJob *job)
+{
+  for (int i = 0; i < MOSAIC_BOX_N_STATES; i++)
+    if (job->images [i])
+      cairo_surface_destroy (job->images [i]);
+  if (job->font_options)
+    cairo_font_options_destroy (job->font_options);
+  g_free (job->name);
+  g_free (job->font);
+  g_object_unref (job->box);
+  g_free (job);
+}
+
+static PangoFontMap *thread_font_map ()
+{
+  PangoFontMap *font_map = g_private_get (&font_map_key);
+  if (!font_map) {
+    font_map = pango_cairo_font_map_new ();
+    g_private_set (&font_map_key, font_map);
+  }
+  return font_map;
+}
+
+static void paint_tile (TileJob *job, cairo_t *cr, PangoLayout *desk, PangoLayout *title,
+			MosaicBoxState state)
+{
+  gboolean has_focus = state & MOSAIC_BOX_STATE_FOCUSED;
+  gint width = job->width - job->thumbnail_width;
+  gint height = job->height;
 
+  paint_fill (cr, job->r, job->g, job->b, job->width, height, state);
+
+  /* Shall we draw the desktop number */
+  if (desk) {
     if (has_focus)
       cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, 0.5);
     else
       cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, 0.5);
 
     int pwidth, pheight;
-    pango_layout_get_pixel_size (pl, &pwidth, &pheight);
+    pango_layout_get_pixel_size (desk, &pwidth, &pheight);
 
     cairo_move_to (cr, (width - pwidth)/2, (height - pheight)/2);
-    pango_cairo_show_layout (cr, pl);
-  }
-
-  gint text_offset = 0;
-
-  if (box->has_icon) {
-    if (box->icon_pixbuf) {
-      guint iwidth = gdk_pixbuf_get_width (box->icon_pixbuf);
-      guint iheight = gdk_pixbuf_get_height (box->icon_pixbuf);
-      cairo_save (cr);
-      cairo_set_source_surface (cr, box->icon_surface, 5, (height-iheight)/2);
-      cairo_rectangle (cr, 0, 0,
-		       iwidth+5,
-		       (height+iheight)/2);
-      cairo_clip (cr);
-      cairo_paint (cr);
-      cairo_restore (cr);
-
-      text_offset = iwidth+5;
-      pango_layout_set_width (pl, (width-iwidth-15) * PANGO_SCALE);
-    }
-  } else {
-    pango_layout_set_width (pl, (width-15) * PANGO_SCALE);
+    pango_cairo_show_layout (cr, desk);
   }
 
   // Draw name.
-  if (box->show_titles) {
-    pango_layout_set_ellipsize (pl, PANGO_ELLIPSIZE_END);
-    pango_layout_set_text (pl, MOSAIC_BOX (box)->name, -1);
-    pfd = pango_font_description_from_string (MOSAIC_BOX (box)->font);
-    pango_layout_set_font_description (pl, pfd);
-    pango_font_description_free (pfd);
-
+  if (title) {
+    gint text_offset = job->icon_width ? job->icon_width+5 : 0;
     int pwidth, pheight;
-    pango_layout_get_pixel_size (pl, &pwidth, &pheight);
+    pango_layout_get_pixel_size (title, &pwidth, &pheight);
 
     if (has_focus)
       cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, 1.0);
@@ -346,11 +575,127 @@ mosaic_window_box_paint (MosaicWindowBox *box, cairo_t *cr, gint width, gint hei
 	cairo_move_to (cr, 5, (height - pheight)/2);
     }
 
-    pango_cairo_show_layout (cr, pl);
+    pango_cairo_show_layout (cr, title);
+  }
+
+  mosaic_box_paint_frame (cr, job->width, height, state);
+}
+
+// Runs in a worker thread.
+static void render_tile_job (gpointer data, gpointer user_data)
+{
+  TileJob *job = data;
+  PangoContext *context = pango_font_map_create_context (thread_font_map ());
+  PangoFontDescription *pfd;
+  PangoLayout *desk = NULL;
+  PangoLayout *title = NULL;
+
+  if (job->font_options)
+    pango_cairo_context_set_font_options (context, job->font_options);
+
+  // Layouts are the same for every state, only colors differ.
+  if (job->show_desktop) {
+    gchar desk_text [4] = { 0 };
+    if (job->desktop > -1)
+      sprintf (desk_text, "%d", job->desktop+1);
+    else
+      sprintf (desk_text, "A");
+
+    desk = pango_layout_new (context);
+    pango_layout_set_text (desk, desk_text, -1);
+    pfd = pango_font_description_from_string (job->font);
+    pango_font_description_set_weight (pfd, PANGO_WEIGHT_BOLD);
+    pango_font_description_set_size (pfd, (job->height-10) * PANGO_SCALE);
+    pango_layout_set_font_description (desk, pfd);
+    pango_font_description_free (pfd);
+  }
+
+  if (job->show_titles) {
+    title = pango_layout_new (context);
+    gint title_width = job->width - job->thumbnail_width;
+    if (job->icon_width)
+      pango_layout_set_width (title, (title_width-job->icon_width-15) * PANGO_SCALE);
+    else
+      pango_layout_set_width (title, (title_width-15) * PANGO_SCALE);
+    pango_layout_set_ellipsize (title, PANGO_ELLIPSIZE_END);
+    pango_layout_set_text (title, job->name, -1);
+    pfd = pango_font_description_from_string (job->font);
+    pango_layout_set_font_description (title, pfd);
+    pango_font_description_free (pfd);
+  }
+
+  for (int state = 0; state < MOSAIC_BOX_N_STATES; state++) {
+    cairo_surface_t *image = cairo_image_surface_create (CAIRO_FORMAT_RGB24, job->width, job->height);
+    cairo_t *cr = cairo_create (image);
+    paint_tile (job, cr, desk, title, state);
+    cairo_destroy (cr);
+    job->images [state] = image;
+  }
+
+  if (desk)
+    g_object_unref (desk);
+  if (title)
+    g_object_unref (title);
+  g_object_unref (context);
+
+  g_idle_add (tile_job_done, job);
+}
+
+// Back in the main thread.
+static gboolean tile_job_done (gpointer data)
+{
+  TileJob *job = data;
+  MosaicWindowBox *box = job->box;
+
+  if (job->serial == box->tile_serial) {
+    for (int i = 0; i < MOSAIC_BOX_N_STATES; i++) {
+      if (box->tile_images [i])
+	cairo_surface_destroy (box->tile_images [i]);
+      box->tile_images [i] = job->images [i];
+      job->images [i] = NULL;
+    }
+    box->tile_job_pending = FALSE;
+    gtk_widget_queue_draw (GTK_WIDGET (box));
   }
-  g_object_unref (pl);
+  tile_job_free (job);
+
+  return FALSE;
+}
+
+static void mosaic_window_box_queue_tile_job (MosaicWindowBox *box)
+{
+  GtkWidget *widget = GTK_WIDGET (box);
+
+  if (!tile_pool)
+    tile_pool = g_thread_pool_new (render_tile_job, NULL,
+				   g_get_num_processors (), FALSE, NULL);
+
+  TileJob *job = g_new0 (TileJob, 1);
+  job->box = g_object_ref (box);
+  job->serial = box->tile_serial;
+  job->width = box->tile_width;
+  job->height = box->tile_height;
+  job->r = box->r;
+  job->g = box->g;
+  job->b = box->b;
+  job->name = g_strdup (MOSAIC_BOX (box)->name);
+  job->font = g_strdup (MOSAIC_BOX (box)->font);
+  const cairo_font_options_t *font_options = gdk_screen_get_font_options (gtk_widget_get_screen (widget));
+  if (font_options)
+    job->font_options = cairo_font_options_copy (font_options);
+  job->show_desktop = box->show_desktop;
+  job->show_titles = box->show_titles;
+  job->desktop = box->desktop;
+  if (box->has_icon && box->icon)
+    job->icon_width = box->icon->width;
+#ifdef X11
+  // Same area as mosaic_window_box_paint_thumbnail draws into.
+  if (box->show_thumbnail && box->is_window)
+    job->thumbnail_width = box->tile_width / 2 + 3;
+#endif
 
-  mosaic_box_paint (MOSAIC_BOX (box), cr, width, height);
+  box->tile_job_pending = TRUE;
+  g_thread_pool_push (tile_pool, job, NULL);
 }
 
 void
@@ -398,6 +743,8 @@ void
 mosaic_window_box_set_name (MosaicWindowBox *box, const gchar *name)
 {
   mosaic_box_set_name (MOSAIC_BOX (box), name);
+  mosaic_window_box_update_search_key (box);
+  mosaic_window_box_invalidate_tiles (box);
 }
 
 const gchar *
@@ -415,12 +762,22 @@ mosaic_window_box_set_opt_name (MosaicWindowBox *box, const gchar *opt_name)
   g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
 
   new_opt_name = g_strdup (opt_name);
+#ifdef X11
+  // WM_CLASS of windows is two strings, keep the class name too.
+  if (box->is_window && opt_name && g_strcmp0 (opt_name, "<empty>")) {
+    gsize len1 = strlen (opt_name) + 1;
+    gsize len2 = strlen (opt_name + len1) + 1;
+    g_free (new_opt_name);
+    new_opt_name = g_memdup (opt_name, len1 + len2);
+  }
+#endif
   g_free (box->opt_name);
   box->opt_name = new_opt_name;
 
   g_object_notify (G_OBJECT (box), "opt_name");
+  mosaic_window_box_update_search_key (box);
   mosaic_window_box_create_colors (box);
-  gtk_widget_queue_draw (GTK_WIDGET (box));
+  mosaic_window_box_invalidate_tiles (box);
 }
 
 const gchar *
@@ -431,6 +788,27 @@ mosaic_window_box_get_opt_name (MosaicWindowBox *box)
   return box->opt_name;
 }
 
+const MosaicSearchKey *mosaic_window_box_get_search_key (MosaicWindowBox *box)
+{
+  g_return_val_if_fail (MOSAIC_IS_WINDOW_BOX (box), NULL);
+
+  return &box->search_key;
+}
+
+// Search keys change only with the names, not on every keystroke.
+static void mosaic_window_box_update_search_key (MosaicWindowBox *box)
+{
+  if (!box->is_window)
+    return;
+
+  const gchar *class = NULL;
+#ifdef X11
+  if (box->opt_name && g_strcmp0 (box->opt_name, "<empty>"))
+    class = box->opt_name + strlen (box->opt_name) + 1;
+#endif
+  mosaic_search_key_set (&box->search_key, MOSAIC_BOX (box)->name, box->opt_name, class);
+}
+
 void mosaic_window_box_update_xwindow_name (MosaicWindowBox *box)
 {
   g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
@@ -468,6 +846,7 @@ void mosaic_window_box_set_desktop (MosaicWindowBox *box, gint desktop)
   g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
 
   box->desktop = desktop;
+  mosaic_window_box_invalidate_tiles (box);
 }
 
 static gushort get_crc16 (gchar *octets, guint len)
@@ -536,104 +915,120 @@ static void mosaic_window_box_create_colors (MosaicWindowBox *box)
   }
 }
 
+static MosaicIcon *load_theme_icon (const gchar *name, guint size)
+{
+  gchar *key = g_strdup_printf ("theme:%s:%u", name, size);
+  MosaicIcon *icon = mosaic_icon_atlas_lookup (key);
+
+  if (!icon) {
+    GtkIconTheme *theme = gtk_icon_theme_get_default ();
+    GdkPixbuf *pixbuf = gtk_icon_theme_load_icon (theme, name, size,
+						  GTK_ICON_LOOKUP_USE_BUILTIN |
+						  GTK_ICON_LOOKUP_GENERIC_FALLBACK,
+						  NULL);
+    if (pixbuf) {
+      icon = mosaic_icon_atlas_add (key, pixbuf);
+      g_object_unref (pixbuf);
+    }
+  }
+  g_free (key);
+
+  return icon;
+}
+
 void mosaic_window_box_setup_icon_from_wm (MosaicWindowBox *box, guint req_width, guint req_height)
 {
   g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
 
+  MosaicIcon *icon = NULL;
   GdkPixbuf *pixbuf = get_window_icon (box->xwindow, req_width, req_height);
-  if (!pixbuf) {
+  if (pixbuf) {
+    // Identical icons of different windows share one atlas cell.
+    gchar *key = mosaic_icon_atlas_key_for_pixbuf (pixbuf);
+    icon = mosaic_icon_atlas_add (key, pixbuf);
+    g_free (key);
+    g_object_unref (pixbuf);
+  } else {
     // Try to load fallback icon.
     gchar *class1 = g_ascii_strdown (box->opt_name, -1);
     gchar *class2 = g_ascii_strdown (box->opt_name+strlen (class1)+1, -1);
 
-    GtkIconTheme *theme = gtk_icon_theme_get_default ();
-    pixbuf = gtk_icon_theme_load_icon (theme, class1, req_width,
-				       GTK_ICON_LOOKUP_USE_BUILTIN |
-				       GTK_ICON_LOOKUP_GENERIC_FALLBACK,
-				       NULL);
-
-    if (!pixbuf)
-      pixbuf = gtk_icon_theme_load_icon (theme, class2, req_width,
-					 GTK_ICON_LOOKUP_USE_BUILTIN |
-					 GTK_ICON_LOOKUP_GENERIC_FALLBACK,
-					 NULL);
-
-    if (!pixbuf)
-      pixbuf = gtk_icon_theme_load_icon (theme, "application-x-executable", req_width,
-					 GTK_ICON_LOOKUP_USE_BUILTIN |
-					 GTK_ICON_LOOKUP_GENERIC_FALLBACK,
-					 NULL);
+    icon = load_theme_icon (class1, req_width);
+    if (!icon)
+      icon = load_theme_icon (class2, req_width);
+    if (!icon)
+      icon = load_theme_icon ("application-x-executable", req_width);
+
     g_free (class1);
     g_free (class2);
   }
-  if (!pixbuf) {
-    box->has_icon = FALSE;
-    return;
-  }
 
-  mosaic_window_box_setup_icon (box, pixbuf);
+  mosaic_window_box_setup_icon (box, icon);
 }
 
 void mosaic_window_box_setup_icon_from_theme (MosaicWindowBox *box, const gchar *name, guint req_width, guint req_height)
 {
   g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
 
-  GtkIconTheme *theme = gtk_icon_theme_get_default ();
-  GdkPixbuf *pixbuf = gtk_icon_theme_load_icon (theme, name, req_width,
-				     GTK_ICON_LOOKUP_USE_BUILTIN |
-				     GTK_ICON_LOOKUP_GENERIC_FALLBACK,
-				     NULL);
-
-  if (!pixbuf) {
-    box->has_icon = FALSE;
-    return;
-  }
-
-  mosaic_window_box_setup_icon (box, pixbuf);
+  mosaic_window_box_setup_icon (box, load_theme_icon (name, req_width));
 }
 
 void mosaic_window_box_setup_icon_from_file (MosaicWindowBox *box, const gchar *file, guint req_width, guint req_height)
 {
   g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
 
-  GError *error = NULL;
-  GdkPixbuf *pixbuf;
-  
-  if(!(pixbuf = gdk_pixbuf_new_from_file_at_size (file, req_width, req_height, &error)))
-    g_printerr("%s\n", error->message);
+  gchar *key = g_strdup_printf ("file:%s:%ux%u", file, req_width, req_height);
+  MosaicIcon *icon = mosaic_icon_atlas_lookup (key);
 
-  if (!pixbuf) {
-    box->has_icon = FALSE;
-    return;
+  if (!icon) {
+    GError *error = NULL;
+    GdkPixbuf *pixbuf;
+
+    if(!(pixbuf = gdk_pixbuf_new_from_file_at_size (file, req_width, req_height, &error)))
+      g_printerr("%s\n", error->message);
+
+    if (pixbuf) {
+      icon = mosaic_icon_atlas_add (key, pixbuf);
+      g_object_unref (pixbuf);
+    }
   }
+  g_free (key);
 
-  mosaic_window_box_setup_icon (box, pixbuf);
+  mosaic_window_box_setup_icon (box, icon);
 }
 
-static void mosaic_window_box_setup_icon (MosaicWindowBox *box, GdkPixbuf *pixbuf)
+void mosaic_window_box_unset_icon (MosaicWindowBox *box)
 {
   g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
 
-  if (box->icon_pixbuf)
-    g_object_unref (box->icon_pixbuf);
-  if (box->icon_surface)
-    cairo_surface_destroy (box->icon_surface);
-  if (box->icon_context)
-    cairo_destroy (box->icon_context);
+  if (box->has_icon)
+    mosaic_window_box_setup_icon (box, NULL);
+}
 
-  if (pixbuf) {
-    box->icon_pixbuf = pixbuf;
-
-    box->has_icon = TRUE;
-    box->icon_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-						    gdk_pixbuf_get_width (box->icon_pixbuf),
-						    gdk_pixbuf_get_height (box->icon_pixbuf));
-    box->icon_context = cairo_create (box->icon_surface);
-    gdk_cairo_set_source_pixbuf (box->icon_context, box->icon_pixbuf, 0, 0);
-    cairo_paint (box->icon_context);
-  } else {
-    box->has_icon = FALSE;
-  }
+// Takes ownership of the icon reference.
+static void mosaic_window_box_setup_icon (MosaicWindowBox *box, MosaicIcon *icon)
+{
+  g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
+
+  if (box->icon)
+    mosaic_icon_unref (box->icon);
+
+  box->icon = icon;
+  box->has_icon = (icon != NULL);
+
+  mosaic_window_box_invalidate_tiles (box);
+}
+
+// Takes icon and color of the other box.
+void mosaic_window_box_copy_decoration (MosaicWindowBox *box, MosaicWindowBox *source)
+{
+  g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
+  g_return_if_fail (MOSAIC_IS_WINDOW_BOX (source));
+
+  box->r = source->r;
+  box->g = source->g;
+  box->b = source->b;
+  mosaic_window_box_setup_icon (box, source->icon ? mosaic_icon_ref (source->icon) : NULL);
 }
 
 void mosaic_window_box_set_colorize (MosaicWindowBox *box, gboolean colorize)
@@ -642,6 +1037,7 @@ void mosaic_window_box_set_colorize (MosaicWindowBox *box, gboolean colorize)
 
   box->colorize = colorize;
   mosaic_window_box_create_colors (box);
+  mosaic_window_box_invalidate_tiles (box);
 }
 
 void mosaic_window_box_set_show_desktop (MosaicWindowBox *box, gboolean show_desktop)
@@ -649,6 +1045,7 @@ void mosaic_window_box_set_show_desktop (MosaicWindowBox *box, gboolean show_des
   g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
 
   box->show_desktop = show_desktop;
+  mosaic_window_box_invalidate_tiles (box);
 }
 
 void mosaic_window_box_set_show_titles (MosaicWindowBox *box, gboolean show_titles)
@@ -658,7 +1055,23 @@ void mosaic_window_box_set_show_titles (MosaicWindowBox *box, gboolean show_titl
   box->show_titles = show_titles;
   if (!show_titles)
     gtk_widget_set_tooltip_text (GTK_WIDGET(box), MOSAIC_BOX(box)->name);
+  mosaic_window_box_invalidate_tiles (box);
+}
+
+#ifdef X11
+void mosaic_window_box_set_show_thumbnail (MosaicWindowBox *box, gboolean show_thumbnail)
+{
+  g_return_if_fail (MOSAIC_IS_WINDOW_BOX (box));
+
+  box->show_thumbnail = show_thumbnail;
+  if (show_thumbnail)
+    mosaic_window_box_update_thumbnail (box);
+  else
+    mosaic_window_box_drop_thumbnail (box);
+  // Title is laid out around the preview.
+  mosaic_window_box_invalidate_tiles (box);
 }
+#endif
 
 void mosaic_window_box_set_color_offset (MosaicWindowBox *box, guchar color_offset)
 {
@@ -666,6 +1079,7 @@ void mosaic_window_box_set_color_offset (MosaicWindowBox *box, guchar color_offs
 
   box->color_offset = color_offset;
   mosaic_window_box_create_colors (box);
+  mosaic_window_box_invalidate_tiles (box);
 }
 
 void mosaic_window_box_set_color_from_string (MosaicWindowBox *box, const gchar *color)
@@ -684,4 +1098,5 @@ void mosaic_window_box_set_color_from_string (MosaicWindowBox *box, const gchar
   box->b = b / 255.0;
 
   g_free (scolor);
+  mosaic_window_box_invalidate_tiles (box);
 }
@@ -11,8 +11,11 @@
 #include <gdk/gdkkeysyms.h>
 #include <string.h>
 #include "mosaic_box.h"
+#include "mosaic_icon_atlas.h"
+#include "mosaic_search.h"
 #ifdef X11
 #include "x_interaction.h"
+#include "mosaic_thumbnail.h"
 #endif
 #ifdef WIN32
 #include "win32_interaction.h"
@@ -48,9 +51,25 @@ struct _MosaicWindowBox
   guchar color_offset;
 
   gboolean has_icon;
-  GdkPixbuf *icon_pixbuf;
-  cairo_t *icon_context;
-  cairo_surface_t *icon_surface;
+  MosaicIcon *icon;
+
+  /* Kept for window boxes only, other items have their own. */
+  MosaicSearchKey search_key;
+
+  /* Server-side pixmaps with the box rendered in each state. */
+  GdkPixmap *tiles [MOSAIC_BOX_N_STATES];
+  gint tile_width, tile_height;
+  /* Rendered by workers, waiting to be uploaded into tiles. */
+  cairo_surface_t *tile_images [MOSAIC_BOX_N_STATES];
+  guint tile_serial;
+  gboolean tile_job_pending;
+
+#ifdef X11
+  /* Live preview drawn over the tile. */
+  gboolean show_thumbnail;
+  MosaicThumbnail *thumbnail;
+  gint thumbnail_width, thumbnail_height;
+#endif
 };
 
 struct _MosaicWindowBoxClass
@@ -77,14 +96,20 @@ void mosaic_window_box_set_name (MosaicWindowBox *box, const gchar *name);
 const gchar *mosaic_window_box_get_name (MosaicWindowBox *box);
 void mosaic_window_box_set_opt_name (MosaicWindowBox *box, const gchar *opt_name);
 const gchar *mosaic_window_box_get_opt_name (MosaicWindowBox *box);
+const MosaicSearchKey *mosaic_window_box_get_search_key (MosaicWindowBox *box);
 void mosaic_window_box_update_xwindow_name (MosaicWindowBox *box);
 void mosaic_window_box_update_opt_name (MosaicWindowBox *box);
 void mosaic_window_box_setup_icon_from_wm (MosaicWindowBox *box, guint req_width, guint req_height);
 void mosaic_window_box_setup_icon_from_theme (MosaicWindowBox *box, const gchar *name, guint req_width, guint req_height);
 void mosaic_window_box_setup_icon_from_file (MosaicWindowBox *box, const gchar *file, guint req_width, guint req_height);
+void mosaic_window_box_unset_icon (MosaicWindowBox *box);
+void mosaic_window_box_copy_decoration (MosaicWindowBox *box, MosaicWindowBox *source);
 void mosaic_window_box_set_colorize (MosaicWindowBox *box, gboolean colorize);
 void mosaic_window_box_set_show_desktop (MosaicWindowBox *box, gboolean show_desktop);
 void mosaic_window_box_set_show_titles (MosaicWindowBox *box, gboolean show_titles);
+#ifdef X11
+void mosaic_window_box_set_show_thumbnail (MosaicWindowBox *box, gboolean show_thumbnail);
+#endif
 void mosaic_window_box_set_color_offset (MosaicWindowBox *box, guchar color_offset);
 void mosaic_window_box_set_color_from_string (MosaicWindowBox *box, const gchar *color);
 gint mosaic_window_box_get_desktop (MosaicWindowBox *box);
@@ -7,6 +7,7 @@
 #include <inttypes.h>
 #include <gdk/gdkx.h>
 #include <gtk/gtk.h>
+#include <X11/XKBlib.h>
 #include "x_interaction.h"
 
 Atom a_UTF8_STRING;
@@ -421,3 +422,41 @@ gboolean already_opened ()
   XFree (win_list);
   return opened;
 }
+
+// Compositing manager owns _NET_WM_CM_S<n> selection of the screen.
+gboolean compositing_manager_running ()
+{
+  Display *dpy = (Display *)gdk_x11_get_default_xdisplay ();
+  gchar *name = g_strdup_printf ("_NET_WM_CM_S%d", DefaultScreen (dpy));
+  Atom selection = XInternAtom (dpy, name, 0);
+  g_free (name);
+
+  return XGetSelectionOwner (dpy, selection) != None;
+}
+
+/* Characters typed by each key in each XKB group, chars[group * n_keys + key]
+ * (0 where the key has none). Returns the number of groups. */
+int get_layout_chars (gunichar **chars, int *n_keys)
+{
+  Display *dpy = (Display *)gdk_x11_get_default_xdisplay ();
+  XkbDescPtr xkb = XkbGetMap (dpy, XkbKeySymsMask, XkbUseCoreKbd);
+  if (!xkb)
+    return 0;
+  if (XkbGetControls (dpy, XkbGroupsWrapMask, xkb) != Success) {
+    XkbFreeKeyboard (xkb, 0, True);
+    return 0;
+  }
+
+  int n_groups = xkb->ctrls->num_groups;
+  *n_keys = xkb->max_key_code - xkb->min_key_code + 1;
+  *chars = g_new0 (gunichar, n_groups * *n_keys);
+  for (int g = 0; g < n_groups; g++)
+    for (int k = 0; k < *n_keys; k++) {
+      KeyCode keycode = xkb->min_key_code + k;
+      if (g < XkbKeyNumGroups (xkb, keycode))
+	(*chars) [g * *n_keys + k] = gdk_keyval_to_unicode (XkbKeySymEntry (xkb, keycode, 0, g));
+    }
+
+  XkbFreeKeyboard (xkb, 0, True);
+  return n_groups;
+}
@@ -61,5 +61,7 @@ Window* sorted_windows_list (Window *myown, Window *active_win, int *nitems, gbo
 void switch_to_window (Window win);
 GdkPixbuf *get_window_icon (Window win, guint req_width, guint req_height);
 gboolean already_opened ();
+gboolean compositing_manager_running ();
+int get_layout_chars (gunichar **chars, int *n_keys);
 
 #endif /* X_INTERACTION_H */